@@ -0,0 +1,179 @@
+/*
+Multi-threaded point-lookup benchmark for the page latches.
+
+Bulk loads the even ids 0, 2, 4, ... into a fresh db file, with a pool
+large enough to keep the whole tree cached, then runs 1, 2, 4, ... up
+to max_threads reader threads doing random table_lookup calls for a
+fixed time each and reports their throughput and the speedup over one
+thread. Every thread count is run twice: readers alone, and readers
+next to one writer inserting odd ids in random order through
+execute_statement, which splits leaves all over the tree while the
+readers descend it. Every lookup checks the row it got back.
+
+Usage: bench_concurrency [rows] [max_threads] [seconds]
+*/
+#include "mydb.h"
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+#define BENCH_DB_FILE "bench_concurrency.db"
+#define BENCH_CHECK_EVERY 256    // 每查这么多次看一眼是否该停了
+
+static void bench_row(uint32_t id, Row* row) {
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+static void reader(Table* table, uint32_t num_rows, uint32_t seed, atomic<bool>* stop,
+                   uint64_t* lookups, uint64_t* failures) {
+    mt19937 rng(seed);
+    Row row;
+    Row expected;
+    uint64_t count = 0;
+    uint64_t failed = 0;
+    while (!stop->load(memory_order_relaxed)) {
+        for (uint32_t i = 0; i < BENCH_CHECK_EVERY; i++) {
+            uint32_t id = rng() % num_rows * 2;
+            bench_row(id, &expected);
+            if (!table_lookup(table, id, &row) || strcmp(row.username, expected.username) != 0 ||
+                strcmp(row.email, expected.email) != 0) {
+                failed++;
+            }
+        }
+        count += BENCH_CHECK_EVERY;
+    }
+    *lookups = count;
+    *failures = failed;
+}
+
+static void writer(Table* table, const vector<uint32_t>* ids, size_t* next, atomic<bool>* stop,
+                   uint64_t* inserts) {
+    Statement statement;
+    statement.type = STATEMENT_INSERT;
+    uint64_t count = 0;
+    while (!stop->load(memory_order_relaxed) && *next < ids->size()) {
+        bench_row((*ids)[(*next)++], &statement.row_to_insert);
+        if (execute_statement(&statement, table, NULL) != EXECUTE_SUCCESS) {
+            cout << "insert of " << statement.row_to_insert.id << " failed" << endl;
+            exit(EXIT_FAILURE);
+        }
+        count++;
+    }
+    *inserts = count;
+}
+
+/* Returns lookups per second; inserts per second go to *insert_rate when there is a writer */
+static double run(Table* table, uint32_t num_rows, uint32_t num_threads, double seconds,
+                  const vector<uint32_t>* insert_ids, size_t* next_insert, double* insert_rate) {
+    atomic<bool> stop(false);
+    vector<uint64_t> lookups(num_threads);
+    vector<uint64_t> failures(num_threads);
+    vector<thread> threads;
+    uint64_t inserts = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(reader, table, num_rows, 1000 * num_threads + i, &stop,
+                             &lookups[i], &failures[i]);
+    }
+    thread write_thread;
+    if (insert_ids) {
+        write_thread = thread(writer, table, insert_ids, next_insert, &stop, &inserts);
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+    for (thread& t : threads) {
+        t.join();
+    }
+    if (insert_ids) {
+        write_thread.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (failures[i] > 0) {
+            cout << failures[i] << " lookups returned a wrong or missing row" << endl;
+            exit(EXIT_FAILURE);
+        }
+        total += lookups[i];
+    }
+    if (insert_rate) {
+        *insert_rate = inserts / elapsed;
+    }
+    return total / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    uint32_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : max(4u, thread::hardware_concurrency());
+    double seconds = argc > 3 ? strtod(argv[3], NULL) : 1.0;
+    if (num_rows == 0 || max_threads == 0 || seconds <= 0) {
+        cout << "Usage: bench_concurrency [rows] [max_threads] [seconds]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    remove(BENCH_DB_FILE);
+    remove(BENCH_DB_FILE "-wal");
+    DbOptions options;
+    db_options_init(&options);
+    // 偶数 id 和写线程插入的奇数 id 都能放进缓冲池
+    options.num_frames = max((uint32_t)PAGER_DEFAULT_NUM_FRAMES, num_rows / 20);
+    Table* table = db_open(BENCH_DB_FILE, &options);
+
+    BulkLoader* loader = bulk_load_begin(table, BULK_LOAD_DEFAULT_FILL_PERCENT);
+    Row row;
+    for (uint32_t i = 0; i < num_rows; i++) {
+        bench_row(i * 2, &row);
+        bulk_load_add(loader, row.id, &row);
+    }
+    bulk_load_finish(loader);
+
+    vector<uint32_t> insert_ids(num_rows);
+    for (uint32_t i = 0; i < num_rows; i++) {
+        insert_ids[i] = i * 2 + 1;
+    }
+    shuffle(insert_ids.begin(), insert_ids.end(), mt19937(42));
+    size_t next_insert = 0;
+
+    cout << num_rows << " rows, " << thread::hardware_concurrency() << " cores, "
+         << seconds << " s per run" << endl;
+    cout << right << setw(8) << "threads" << setw(14) << "lookups/s" << setw(9) << "speedup"
+         << setw(16) << "+writer lkp/s" << setw(9) << "speedup" << setw(12) << "inserts/s" << endl;
+    double base = 0;
+    double base_with_writer = 0;
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        double rate = run(table, num_rows, threads, seconds, NULL, NULL, NULL);
+        double insert_rate = 0;
+        double rate_with_writer = run(table, num_rows, threads, seconds, &insert_ids, &next_insert,
+                                      &insert_rate);
+        if (threads == 1) {
+            base = rate;
+            base_with_writer = rate_with_writer;
+        }
+        cout << fixed << setprecision(0) << setw(8) << threads << setw(14) << rate
+             << setprecision(2) << setw(9) << rate / base
+             << setprecision(0) << setw(16) << rate_with_writer
+             << setprecision(2) << setw(9) << rate_with_writer / base_with_writer
+             << setprecision(0) << setw(12) << insert_rate << endl;
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+
+    // 写线程插入的行也都要查得到
+    for (size_t i = 0; i < next_insert; i++) {
+        if (!table_lookup(table, insert_ids[i], &row)) {
+            cout << "inserted id " << insert_ids[i] << " is missing" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    db_close(table);
+    remove(BENCH_DB_FILE);
+    remove(BENCH_DB_FILE "-wal");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/*
+Single-threaded benchmark suite for catching regressions between
+releases. Runs each workload through the embedding API against a db
+file of `rows` rows with a buffer pool of `cache_pages` pages, and
+prints one JSON object with ops/s and p50/p99 latency per workload:
+
+  sequential_insert  ids 0, 1, 2, ... into an empty table
+  random_insert      the same ids shuffled, into an empty table
+  uniform_lookup     db_get of uniformly random ids
+  zipfian_lookup     db_get of scrambled Zipfian ids (theta 0.99)
+  range_scan         scans of BENCH_RANGE_SCAN_ROWS rows from random ids
+  full_scan          scans of the whole table
+  reopen             db_close followed by db_open
+
+Lookups and scans run on the table random_insert built. Every random
+choice comes from a fixed seed, so runs with the same arguments do the
+same work. A scan is one op; rows_per_sec gives the rows it read.
+
+Usage: bench_mydb [rows] [cache_pages] [lookups]
+*/
+#include "api.h"
+#include "workload.h"
+#include <iomanip>
+
+using namespace std;
+
+#define BENCH_DB_FILE "bench_mydb.db"
+#define BENCH_SEED 42
+#define BENCH_RANGE_SCAN_ROWS 100
+#define BENCH_FULL_SCANS 5
+#define BENCH_REOPENS 20
+
+typedef struct {
+    const char* name;
+    uint64_t rows;                  // 扫描读到的行数，其他负载为 0
+    double seconds;
+    vector<uint64_t> nanoseconds;   // 每个操作的耗时
+} WorkloadResult;
+
+typedef chrono::steady_clock::time_point TimePoint;
+
+static uint64_t nanoseconds_since(TimePoint start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+static void remove_db() {
+    remove(BENCH_DB_FILE);
+    remove(BENCH_DB_FILE "-wal");
+}
+
+/* Insert ids in the given order into a new db file and leave it open */
+static Table* run_inserts(WorkloadResult* result, const vector<uint32_t>& ids, DbOptions* options) {
+    remove_db();
+    Table* table = db_open(BENCH_DB_FILE, options);
+    Row row;
+    TimePoint start = chrono::steady_clock::now();
+    for (uint32_t id : ids) {
+        workload_row(id, &row);
+        TimePoint op_start = chrono::steady_clock::now();
+        if (db_insert(table, &row) != EXECUTE_SUCCESS) {
+            cout << "insert of " << id << " failed" << endl;
+            exit(EXIT_FAILURE);
+        }
+        result->nanoseconds.push_back(nanoseconds_since(op_start));
+    }
+    result->seconds = nanoseconds_since(start) / 1e9;
+    return table;
+}
+
+static void run_lookups(WorkloadResult* result, Table* table, uint32_t num_rows, uint64_t lookups,
+                        Zipfian* zipf) {
+    mt19937_64 rng(BENCH_SEED);
+    Row row;
+    TimePoint start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < lookups; i++) {
+        uint32_t id = zipf ? zipfian_next_scrambled(zipf, &rng) : rng() % num_rows;
+        TimePoint op_start = chrono::steady_clock::now();
+        bool found = db_get(table, id, &row);
+        result->nanoseconds.push_back(nanoseconds_since(op_start));
+        if (!found || row.id != id) {
+            cout << "lookup of " << id << " failed" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    result->seconds = nanoseconds_since(start) / 1e9;
+}
+
+/* num_scans scans of scan_rows rows each, from random ids unless scan_rows covers the table */
+static void run_scans(WorkloadResult* result, Table* table, uint32_t num_rows, uint64_t num_scans,
+                      uint32_t scan_rows) {
+    mt19937_64 rng(BENCH_SEED);
+    Row row;
+    TimePoint start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < num_scans; i++) {
+        uint32_t first = scan_rows >= num_rows ? 0 : rng() % (num_rows - scan_rows + 1);
+        TimePoint op_start = chrono::steady_clock::now();
+        DbScan* scan = db_scan_begin(table, first, first + scan_rows - 1);
+        uint64_t count = 0;
+        while (db_scan_next(scan, &row)) {
+            count++;
+        }
+        db_scan_end(scan);
+        result->nanoseconds.push_back(nanoseconds_since(op_start));
+        if (count != min(scan_rows, num_rows)) {
+            cout << "scan from " << first << " read " << count << " rows" << endl;
+            exit(EXIT_FAILURE);
+        }
+        result->rows += count;
+    }
+    result->seconds = nanoseconds_since(start) / 1e9;
+}
+
+static Table* run_reopens(WorkloadResult* result, Table* table, DbOptions* options) {
+    TimePoint start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_REOPENS; i++) {
+        TimePoint op_start = chrono::steady_clock::now();
+        db_close(table);
+        table = db_open(BENCH_DB_FILE, options);
+        result->nanoseconds.push_back(nanoseconds_since(op_start));
+    }
+    result->seconds = nanoseconds_since(start) / 1e9;
+    return table;
+}
+
+static void print_json(const vector<WorkloadResult>& results, uint32_t num_rows, uint32_t cache_pages,
+                       uint64_t lookups) {
+    cout << fixed << setprecision(3);
+    cout << "{\n";
+    cout << "  \"rows\": " << num_rows << ",\n";
+    cout << "  \"cache_pages\": " << cache_pages << ",\n";
+    cout << "  \"lookups\": " << lookups << ",\n";
+    cout << "  \"search\": \"" << search_implementation() << "\",\n";
+    cout << "  \"workloads\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        WorkloadResult result = results[i];     // 取百分位会重排样本，用副本
+        uint64_t ops = result.nanoseconds.size();
+        cout << "    {\"name\": \"" << result.name << "\", \"ops\": " << ops
+             << ", \"seconds\": " << result.seconds
+             << ", \"ops_per_sec\": " << (result.seconds > 0 ? ops / result.seconds : 0.0);
+        if (result.rows > 0) {
+            cout << ", \"rows_per_sec\": " << (result.seconds > 0 ? result.rows / result.seconds : 0.0);
+        }
+        cout << ", \"p50_us\": " << latency_percentile(&result.nanoseconds, 0.5)
+             << ", \"p99_us\": " << latency_percentile(&result.nanoseconds, 0.99) << "}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    cout << "  ]\n";
+    cout << "}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    uint32_t cache_pages = argc > 2 ? strtoul(argv[2], NULL, 10) : PAGER_DEFAULT_NUM_FRAMES;
+    uint64_t lookups = argc > 3 ? strtoull(argv[3], NULL, 10) : num_rows;
+    if (num_rows == 0 || cache_pages == 0 || lookups == 0) {
+        cout << "Usage: bench_mydb [rows] [cache_pages] [lookups]" << endl;
+        return EXIT_FAILURE;
+    }
+    DbOptions options;
+    db_options_init(&options);
+    options.num_frames = cache_pages;
+
+    vector<uint32_t> ids(num_rows);
+    for (uint32_t i = 0; i < num_rows; i++) {
+        ids[i] = i;
+    }
+    vector<WorkloadResult> results(7);
+    results[0].name = "sequential_insert";
+    results[1].name = "random_insert";
+    results[2].name = "uniform_lookup";
+    results[3].name = "zipfian_lookup";
+    results[4].name = "range_scan";
+    results[5].name = "full_scan";
+    results[6].name = "reopen";
+    for (WorkloadResult& result : results) {
+        result.rows = 0;
+    }
+
+    db_close(run_inserts(&results[0], ids, &options));
+    shuffle(ids.begin(), ids.end(), mt19937_64(BENCH_SEED));
+    Table* table = run_inserts(&results[1], ids, &options);
+    run_lookups(&results[2], table, num_rows, lookups, NULL);
+    Zipfian zipf;
+    zipfian_init(&zipf, num_rows, ZIPFIAN_DEFAULT_THETA);
+    run_lookups(&results[3], table, num_rows, lookups, &zipf);
+    run_scans(&results[4], table, num_rows, max((uint64_t)1, lookups / BENCH_RANGE_SCAN_ROWS),
+              BENCH_RANGE_SCAN_ROWS);
+    run_scans(&results[5], table, num_rows, BENCH_FULL_SCANS, num_rows);
+    table = run_reopens(&results[6], table, &options);
+    db_close(table);
+    remove_db();
+
+    print_json(results, num_rows, cache_pages, lookups);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*
+Point-lookup microbenchmark for the in-node key search.
+
+Builds a few thousand 4 KB pages of both node kinds in memory, more
+than the CPU caches hold, and times random lookups of a key within a
+random page:
+
+  interleaved  the old layout: key next to its value (leaf) or child
+               (internal) in one cell, binary search with a stride
+  dense        keys in their own array, the same binary search
+  dense+simd   keys in their own array, search_lower_bound
+
+Usage: bench_search [pages] [lookups]
+*/
+#include "search.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+#define BENCH_PAGE_SIZE 4096
+#define BENCH_LEAF_VALUE_SIZE 293   // ROW_SIZE
+#define BENCH_LEAF_KEYS 13
+#define BENCH_INTERNAL_KEYS 510
+
+typedef uint32_t (*LookupFn)(const char* page, uint32_t num_keys, uint32_t key, uint32_t stride);
+
+/* The search the leaves and internal nodes used before keys were split out */
+static uint32_t lookup_interleaved(const char* page, uint32_t num_keys, uint32_t key, uint32_t stride) {
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        uint32_t key_at_index;
+        memcpy(&key_at_index, page + 16 + index * stride, sizeof(uint32_t));
+        if (key_at_index >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+static uint32_t lookup_dense(const char* page, uint32_t num_keys, uint32_t key, uint32_t) {
+    return search_lower_bound_scalar((const uint32_t*)(page + 16), num_keys, key);
+}
+
+static uint32_t lookup_dense_simd(const char* page, uint32_t num_keys, uint32_t key, uint32_t) {
+    return search_lower_bound((const uint32_t*)(page + 16), num_keys, key);
+}
+
+/* Page i holds keys i*step + 2, i*step + 4, ...; dense pages keep them packed */
+static void fill_pages(char* pages, uint32_t num_pages, uint32_t num_keys, uint32_t stride) {
+    for (uint32_t p = 0; p < num_pages; p++) {
+        char* page = pages + (size_t)p * BENCH_PAGE_SIZE;
+        for (uint32_t i = 0; i < num_keys; i++) {
+            uint32_t key = p * 4 * num_keys + 2 * (i + 1);
+            memcpy(page + 16 + i * stride, &key, sizeof(uint32_t));
+        }
+    }
+}
+
+static double run(LookupFn lookup, const char* pages, uint32_t num_pages, uint32_t num_keys,
+                  uint32_t stride, const vector<uint32_t>& targets, uint64_t* checksum) {
+    auto start = chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        uint32_t page_num = targets[i] % num_pages;
+        uint32_t key = page_num * 4 * num_keys + targets[i] / num_pages % (2 * num_keys + 2);
+        sum += lookup(pages + (size_t)page_num * BENCH_PAGE_SIZE, num_keys, key, stride);
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+    *checksum = sum;
+    return (double)elapsed.count() / targets.size();
+}
+
+static void bench_node(const char* name, uint32_t num_keys, uint32_t cell_size,
+                       uint32_t num_pages, const vector<uint32_t>& targets) {
+    size_t bytes = (size_t)num_pages * BENCH_PAGE_SIZE;
+    char* interleaved = static_cast<char*>(aligned_alloc(BENCH_PAGE_SIZE, bytes));
+    char* dense = static_cast<char*>(aligned_alloc(BENCH_PAGE_SIZE, bytes));
+    memset(interleaved, 0, bytes);
+    memset(dense, 0, bytes);
+    fill_pages(interleaved, num_pages, num_keys, cell_size);
+    fill_pages(dense, num_pages, num_keys, sizeof(uint32_t));
+
+    uint64_t expected, checksum;
+    double before = run(lookup_interleaved, interleaved, num_pages, num_keys, cell_size, targets, &expected);
+    double scalar = run(lookup_dense, dense, num_pages, num_keys, 0, targets, &checksum);
+    if (checksum != expected) {
+        cout << "dense search disagrees with interleaved search" << endl;
+        exit(EXIT_FAILURE);
+    }
+    double simd = run(lookup_dense_simd, dense, num_pages, num_keys, 0, targets, &checksum);
+    if (checksum != expected) {
+        cout << "SIMD search disagrees with interleaved search" << endl;
+        exit(EXIT_FAILURE);
+    }
+    cout << left << setw(10) << name << right << fixed << setprecision(1)
+         << setw(14) << before << setw(10) << scalar << setw(14) << simd << endl;
+    free(interleaved);
+    free(dense);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_pages = argc > 1 ? strtoul(argv[1], NULL, 10) : 16384;
+    uint32_t num_lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000000;
+    if (num_pages == 0 || num_lookups == 0) {
+        cout << "Usage: bench_search [pages] [lookups]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    mt19937 rng(42);
+    vector<uint32_t> targets(num_lookups);
+    for (uint32_t& target : targets) {
+        target = rng();
+    }
+
+    cout << "search: " << search_implementation() << ", " << num_pages << " pages, "
+         << num_lookups << " lookups" << endl;
+    cout << left << setw(10) << "ns/op" << right
+         << setw(14) << "interleaved" << setw(10) << "dense" << setw(14) << "dense+simd" << endl;
+    bench_node("leaf", BENCH_LEAF_KEYS, sizeof(uint32_t) + BENCH_LEAF_VALUE_SIZE, num_pages, targets);
+    bench_node("internal", BENCH_INTERNAL_KEYS, 2 * sizeof(uint32_t), num_pages, targets);
+    return EXIT_SUCCESS;
+}
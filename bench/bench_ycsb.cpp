@@ -0,0 +1,358 @@
+/*
+YCSB-style mixed workload driver.
+
+Bulk loads `records` rows with ids 0 .. records-1 into a fresh db file,
+then runs `threads` client threads for `seconds`, each issuing the
+operation mix of one of the YCSB core workloads:
+
+  a  50% read, 50% update                  zipfian
+  b  95% read, 5% update                   zipfian
+  c  100% read                             zipfian
+  d  95% read, 5% insert                   latest
+  e  95% scan of 1-100 rows, 5% insert     zipfian
+  f  50% read, 50% read-modify-write       zipfian
+
+The key distribution can be overridden with uniform, zipfian (scrambled,
+theta 0.99) or latest (the newest rows are the most popular). Inserts
+append ids after the loaded ones. Operations go through the embedding
+API, so every write is its own committed statement. The zipfian and
+latest distributions grow with the inserted rows, as in YCSB.
+
+Throughput and the buffer pool hit ratio are sampled every
+BENCH_REPORT_MS and printed to stderr as the run goes, which shows cache
+warmup and the dips of split-heavy stretches. At the end one JSON object
+goes to stdout with that timeline and the count and p50/p99 latency of
+each operation. Clients only pick ids that have been inserted and
+updates replace rows in place, so read_misses and update_failures
+should stay 0; anything else means a row went missing.
+
+Usage: bench_ycsb <a-f> [records] [seconds] [threads] [distribution] [cache_pages]
+*/
+#include "api.h"
+#include "workload.h"
+#include <iomanip>
+#include <thread>
+
+using namespace std;
+
+#define BENCH_DB_FILE "bench_ycsb.db"
+#define BENCH_SEED 42
+#define BENCH_REPORT_MS 1000
+#define BENCH_MAX_SCAN_ROWS 100
+#define BENCH_CHECK_EVERY 64    // 每做这么多个操作看一眼是否该停了
+
+typedef enum {
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_READ_MODIFY_WRITE,
+    OP_COUNT
+} OpType;
+
+static const char* OP_NAMES[OP_COUNT] = {"read", "update", "insert", "scan", "read_modify_write"};
+
+typedef enum {
+    KEYS_UNIFORM,
+    KEYS_ZIPFIAN,
+    KEYS_LATEST
+} KeyDistribution;
+
+static const char* DISTRIBUTION_NAMES[] = {"uniform", "zipfian", "latest"};
+
+typedef struct {
+    char name;
+    double proportions[OP_COUNT];   // 按 OpType 的顺序，和为 1
+    KeyDistribution distribution;
+} YcsbWorkload;
+
+static const YcsbWorkload WORKLOADS[] = {
+    {'a', {0.50, 0.50, 0.00, 0.00, 0.00}, KEYS_ZIPFIAN},
+    {'b', {0.95, 0.05, 0.00, 0.00, 0.00}, KEYS_ZIPFIAN},
+    {'c', {1.00, 0.00, 0.00, 0.00, 0.00}, KEYS_ZIPFIAN},
+    {'d', {0.95, 0.00, 0.05, 0.00, 0.00}, KEYS_LATEST},
+    {'e', {0.00, 0.00, 0.05, 0.95, 0.00}, KEYS_ZIPFIAN},
+    {'f', {0.50, 0.00, 0.00, 0.00, 0.50}, KEYS_ZIPFIAN},
+};
+
+/* State shared by the client threads */
+typedef struct {
+    Table* table;
+    const YcsbWorkload* workload;
+    KeyDistribution distribution;
+    Zipfian zipf;                   // 覆盖装载的行，客户端各复制一份
+    atomic<uint32_t> next_insert;   // 下一个插入的 id
+    atomic<uint32_t> num_keys;      // 已经插入完的 id 个数，读只挑这之前的
+    atomic<bool> stop;
+} Ycsb;
+
+/* One per client thread, padded so that the counters don't share cache lines */
+typedef struct alignas(64) {
+    atomic<uint64_t> ops;           // 报告线程定时读
+    uint64_t read_misses;
+    uint64_t update_failures;       // db_update 没有成功
+    Zipfian zipf;                   // 随插入的行增长，只有本线程用
+    vector<uint64_t> nanoseconds[OP_COUNT];
+} Client;
+
+static uint32_t next_key(Ycsb* ycsb, Client* me, mt19937_64* rng) {
+    uint32_t num_keys = ycsb->num_keys.load(memory_order_acquire);
+    switch (ycsb->distribution) {
+        case KEYS_UNIFORM:
+            return (*rng)() % num_keys;
+        case KEYS_ZIPFIAN:
+            zipfian_grow(&me->zipf, num_keys);
+            return zipfian_next_scrambled(&me->zipf, rng);
+        case KEYS_LATEST:
+            // 排名 0 是最新插入的行
+            zipfian_grow(&me->zipf, num_keys);
+            return num_keys - 1 - zipfian_next(&me->zipf, rng);
+    }
+    return 0;
+}
+
+static OpType choose_op(const YcsbWorkload* workload, mt19937_64* rng) {
+    double u = ((*rng)() >> 11) * (1.0 / 9007199254740992.0);
+    for (uint32_t op = 0; op < OP_COUNT; op++) {
+        if (u < workload->proportions[op]) {
+            return (OpType)op;
+        }
+        u -= workload->proportions[op];
+    }
+    return OP_READ;
+}
+
+/* A new version of the row, so that updates change what is stored */
+static void updated_row(uint32_t id, uint64_t version, Row* row) {
+    workload_row(id, row);
+    snprintf(row->email, sizeof(row->email), "person%u.v%lu@example.com", id, (unsigned long)version);
+}
+
+static void client(Ycsb* ycsb, Client* me, uint32_t seed) {
+    mt19937_64 rng(seed);
+    Table* table = ycsb->table;
+    Row row;
+    uint64_t version = 0;
+    while (!ycsb->stop.load(memory_order_relaxed)) {
+        for (uint32_t i = 0; i < BENCH_CHECK_EVERY; i++) {
+            OpType op = choose_op(ycsb->workload, &rng);
+            uint32_t id = op == OP_INSERT ? ycsb->next_insert.fetch_add(1) : next_key(ycsb, me, &rng);
+            auto start = chrono::steady_clock::now();
+            switch (op) {
+                case OP_READ:
+                    if (!db_get(table, id, &row)) {
+                        me->read_misses++;
+                    }
+                    break;
+                case OP_UPDATE:
+                    updated_row(id, ++version, &row);
+                    if (db_update(table, &row) != EXECUTE_SUCCESS) {
+                        me->update_failures++;
+                    }
+                    break;
+                case OP_INSERT: {
+                    workload_row(id, &row);
+                    if (db_insert(table, &row) != EXECUTE_SUCCESS) {
+                        cout << "insert of " << id << " failed" << endl;
+                        exit(EXIT_FAILURE);
+                    }
+                    // 按插入顺序公布；前面的插入还没完成时先等它
+                    uint32_t expected = id;
+                    while (!ycsb->num_keys.compare_exchange_weak(expected, id + 1, memory_order_release)) {
+                        expected = id;
+                        this_thread::yield();
+                    }
+                    break;
+                }
+                case OP_SCAN: {
+                    uint32_t length = 1 + rng() % BENCH_MAX_SCAN_ROWS;
+                    DbScan* scan = db_scan_begin(table, id, id + length - 1 < id ? UINT32_MAX : id + length - 1);
+                    while (db_scan_next(scan, &row)) {
+                    }
+                    db_scan_end(scan);
+                    break;
+                }
+                case OP_READ_MODIFY_WRITE:
+                    if (!db_get(table, id, &row)) {
+                        me->read_misses++;
+                    }
+                    updated_row(id, ++version, &row);
+                    if (db_update(table, &row) != EXECUTE_SUCCESS) {
+                        me->update_failures++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            me->nanoseconds[op].push_back(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count());
+        }
+        me->ops.fetch_add(BENCH_CHECK_EVERY, memory_order_relaxed);
+    }
+}
+
+static void load(Table* table, uint32_t records) {
+    BulkLoader* loader = bulk_load_begin(table, BULK_LOAD_DEFAULT_FILL_PERCENT);
+    Row row;
+    for (uint32_t id = 0; id < records; id++) {
+        workload_row(id, &row);
+        bulk_load_add(loader, id, &row);
+    }
+    bulk_load_finish(loader);
+}
+
+static void pool_counts(Pager* pager, uint64_t* hits, uint64_t* misses) {
+    shared_lock<shared_mutex> lock(pager->mutex);
+    *hits = pager->stats.hits;
+    *misses = pager->stats.misses;
+}
+
+int main(int argc, char* argv[]) {
+    const YcsbWorkload* workload = NULL;
+    for (const YcsbWorkload& candidate : WORKLOADS) {
+        if (argc > 1 && argv[1][0] == candidate.name && argv[1][1] == '\0') {
+            workload = &candidate;
+        }
+    }
+    uint32_t records = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+    double seconds = argc > 3 ? strtod(argv[3], NULL) : 10.0;
+    uint32_t num_threads = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+    KeyDistribution distribution = workload ? workload->distribution : KEYS_ZIPFIAN;
+    bool distribution_known = true;
+    if (argc > 5) {
+        string name = argv[5];
+        distribution_known = false;
+        for (uint32_t i = 0; i < 3; i++) {
+            if (name == DISTRIBUTION_NAMES[i]) {
+                distribution = (KeyDistribution)i;
+                distribution_known = true;
+            }
+        }
+    }
+    uint32_t cache_pages = argc > 6 ? strtoul(argv[6], NULL, 10) : PAGER_DEFAULT_NUM_FRAMES;
+    if (workload == NULL || !distribution_known || records == 0 || seconds <= 0 || num_threads == 0 ||
+        cache_pages == 0) {
+        cout << "Usage: bench_ycsb <a-f> [records] [seconds] [threads] [uniform|zipfian|latest] "
+                "[cache_pages]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    remove(BENCH_DB_FILE);
+    remove(BENCH_DB_FILE "-wal");
+    DbOptions options;
+    db_options_init(&options);
+    options.num_frames = cache_pages;
+    Ycsb ycsb;
+    ycsb.table = db_open(BENCH_DB_FILE, &options);
+    load(ycsb.table, records);
+    ycsb.workload = workload;
+    ycsb.distribution = distribution;
+    zipfian_init(&ycsb.zipf, records, ZIPFIAN_DEFAULT_THETA);
+    ycsb.next_insert = records;
+    ycsb.num_keys = records;
+    ycsb.stop = false;
+
+    vector<Client> clients(num_threads);
+    vector<thread> threads;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        clients[i].ops = 0;
+        clients[i].read_misses = 0;
+        clients[i].update_failures = 0;
+        clients[i].zipf = ycsb.zipf;
+    }
+    uint64_t hits;
+    uint64_t misses;
+    pool_counts(ycsb.table->pager, &hits, &misses);
+    auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(client, &ycsb, &clients[i], BENCH_SEED + i);
+    }
+
+    // 定时采样吞吐量和缓冲池命中率
+    vector<double> timeline_seconds;
+    vector<double> timeline_ops;
+    vector<double> timeline_hit_ratio;
+    uint64_t last_ops = 0;
+    double elapsed = 0;
+    cerr << fixed << setprecision(1);
+    while (elapsed < seconds) {
+        double interval = min(BENCH_REPORT_MS / 1000.0, seconds - elapsed);
+        this_thread::sleep_for(chrono::duration<double>(interval));
+        double now = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        uint64_t ops = 0;
+        for (Client& c : clients) {
+            ops += c.ops.load(memory_order_relaxed);
+        }
+        uint64_t new_hits;
+        uint64_t new_misses;
+        pool_counts(ycsb.table->pager, &new_hits, &new_misses);
+        uint64_t lookups = new_hits - hits + new_misses - misses;
+        double hit_ratio = lookups ? (double)(new_hits - hits) / lookups : 0.0;
+        timeline_seconds.push_back(now);
+        timeline_ops.push_back((ops - last_ops) / (now - elapsed));
+        timeline_hit_ratio.push_back(hit_ratio);
+        cerr << setw(8) << now << " s" << setw(12) << timeline_ops.back() << " ops/s"
+             << setw(8) << hit_ratio * 100 << "% hits" << endl;
+        last_ops = ops;
+        hits = new_hits;
+        misses = new_misses;
+        elapsed = now;
+    }
+    ycsb.stop = true;
+    for (thread& t : threads) {
+        t.join();
+    }
+    double total_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<uint64_t> nanoseconds[OP_COUNT];
+    uint64_t total_ops = 0;
+    uint64_t read_misses = 0;
+    uint64_t update_failures = 0;
+    for (Client& c : clients) {
+        for (uint32_t op = 0; op < OP_COUNT; op++) {
+            nanoseconds[op].insert(nanoseconds[op].end(), c.nanoseconds[op].begin(), c.nanoseconds[op].end());
+            total_ops += c.nanoseconds[op].size();
+        }
+        read_misses += c.read_misses;
+        update_failures += c.update_failures;
+    }
+
+    cout << fixed << setprecision(3);
+    cout << "{\n";
+    cout << "  \"workload\": \"" << workload->name << "\",\n";
+    cout << "  \"records\": " << records << ",\n";
+    cout << "  \"threads\": " << num_threads << ",\n";
+    cout << "  \"distribution\": \"" << DISTRIBUTION_NAMES[distribution] << "\",\n";
+    cout << "  \"cache_pages\": " << cache_pages << ",\n";
+    cout << "  \"seconds\": " << total_seconds << ",\n";
+    cout << "  \"ops\": " << total_ops << ",\n";
+    cout << "  \"ops_per_sec\": " << total_ops / total_seconds << ",\n";
+    cout << "  \"read_misses\": " << read_misses << ",\n";
+    cout << "  \"update_failures\": " << update_failures << ",\n";
+    cout << "  \"operations\": [\n";
+    bool first = true;
+    for (uint32_t op = 0; op < OP_COUNT; op++) {
+        if (nanoseconds[op].empty()) {
+            continue;
+        }
+        cout << (first ? "" : ",\n") << "    {\"name\": \"" << OP_NAMES[op] << "\", \"ops\": "
+             << nanoseconds[op].size()
+             << ", \"p50_us\": " << latency_percentile(&nanoseconds[op], 0.5)
+             << ", \"p99_us\": " << latency_percentile(&nanoseconds[op], 0.99) << "}";
+        first = false;
+    }
+    cout << "\n  ],\n";
+    cout << "  \"timeline\": [\n";
+    for (size_t i = 0; i < timeline_ops.size(); i++) {
+        cout << "    {\"second\": " << timeline_seconds[i] << ", \"ops_per_sec\": " << timeline_ops[i]
+             << ", \"hit_ratio\": " << timeline_hit_ratio[i] << "}"
+             << (i + 1 < timeline_ops.size() ? "," : "") << "\n";
+    }
+    cout << "  ]\n";
+    cout << "}" << endl;
+
+    db_close(ycsb.table);
+    remove(BENCH_DB_FILE);
+    remove(BENCH_DB_FILE "-wal");
+    return EXIT_SUCCESS;
+}
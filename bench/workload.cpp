@@ -0,0 +1,65 @@
+#include "workload.h"
+#include <cmath>
+
+using namespace std;
+
+void zipfian_init(Zipfian* zipf, uint64_t n, double theta) {
+    zipf->n = 0;
+    zipf->theta = theta;
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->zetan = 0;
+    zipf->half_pow_theta = pow(0.5, theta);
+    zipfian_grow(zipf, n);
+}
+
+void zipfian_grow(Zipfian* zipf, uint64_t n) {
+    if (n <= zipf->n) {
+        return;
+    }
+    for (uint64_t i = zipf->n + 1; i <= n; i++) {
+        zipf->zetan += 1.0 / pow((double)i, zipf->theta);
+    }
+    zipf->n = n;
+    double zeta2 = 1.0 + zipf->half_pow_theta;
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - zipf->theta)) / (1.0 - zeta2 / zipf->zetan);
+}
+
+uint64_t zipfian_next(Zipfian* zipf, mt19937_64* rng) {
+    // 53 位随机数换成 [0, 1) 的 double，不依赖标准库的分布实现
+    double u = ((*rng)() >> 11) * (1.0 / 9007199254740992.0);
+    double uz = u * zipf->zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + zipf->half_pow_theta) {
+        return 1;
+    }
+    uint64_t rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    return min(rank, zipf->n - 1);
+}
+
+uint64_t zipfian_next_scrambled(Zipfian* zipf, mt19937_64* rng) {
+    // FNV-1a 64 打散排名，和 YCSB 的 ScrambledZipfianGenerator 一样
+    uint64_t rank = zipfian_next(zipf, rng);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash % zipf->n;
+}
+
+void workload_row(uint32_t id, Row* row) {
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+double latency_percentile(vector<uint64_t>* nanoseconds, double fraction) {
+    if (nanoseconds->empty()) {
+        return 0;
+    }
+    size_t index = min(nanoseconds->size() - 1, (size_t)(fraction * nanoseconds->size()));
+    nth_element(nanoseconds->begin(), nanoseconds->begin() + index, nanoseconds->end());
+    return (*nanoseconds)[index] / 1000.0;
+}
@@ -0,0 +1,44 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "mydb.h"
+#include <random>
+#include <vector>
+
+/*
+ * Workload helpers shared by the benchmarks: key generators, the rows
+ * they store and latency percentiles. Every generator takes a seeded
+ * mt19937_64, so runs with the same arguments issue the same operations.
+ */
+#define ZIPFIAN_DEFAULT_THETA 0.99
+
+/*
+Zipfian ranks in [0, n), rank 0 the most popular, drawn with the method
+of Gray et al., "Quickly Generating Billion-Record Synthetic Databases",
+as YCSB does. Setup sums n terms once; each draw is O(1). Growing n
+only sums the new terms.
+*/
+typedef struct {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;  // 0.5^theta，排名 1 的分界
+} Zipfian;
+
+void zipfian_init(Zipfian* zipf, uint64_t n, double theta);
+/* Extend the ranks to [0, n) after rows were added; n never shrinks */
+void zipfian_grow(Zipfian* zipf, uint64_t n);
+uint64_t zipfian_next(Zipfian* zipf, std::mt19937_64* rng);
+
+/* A Zipfian rank hashed over [0, n), so the popular keys do not share leaves */
+uint64_t zipfian_next_scrambled(Zipfian* zipf, std::mt19937_64* rng);
+
+/* The row the benchmarks store under id */
+void workload_row(uint32_t id, Row* row);
+
+/* The given fraction (0.5 for p50) of the samples, in microseconds; reorders them */
+double latency_percentile(std::vector<uint64_t>* nanoseconds, double fraction);
+
+#endif
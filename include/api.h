@@ -0,0 +1,52 @@
+#ifndef API_H
+#define API_H
+
+#include "mydb_types.h"
+
+/*
+ * Embedding API
+ * A program linking libmydb includes this header only. It opens a
+ * database with db_open, works on rows with the functions below and
+ * closes it with db_close; Table and DbScan stay opaque. They run the same
+ * code as the REPL's statements without parsing or printing anything:
+ * each insert, update or delete is its own transaction, committed before it
+ * returns, and may run while other threads read or scan.
+ *
+ *   Table* table = db_open("users.db", &options);
+ *   db_insert(table, &row);
+ *   DbScan* scan = db_scan_begin(table, 0, UINT32_MAX);
+ *   while (db_scan_next(scan, &row)) { ... }
+ *   db_scan_end(scan);
+ *   db_close(table);
+ *
+ * A scan returns rows in id order. It copies one leaf's rows at a time
+ * and holds no latch between calls, so the thread running it may insert
+ * and delete while it is open. A row changed after the scan has passed
+ * it is not seen; a row changed ahead of it is.
+ */
+typedef struct DbScan DbScan;
+
+/* Fills in the defaults; set fields afterwards to change them */
+void db_options_init(DbOptions* options);
+Table* db_open(const char* filename, DbOptions* options);
+/* Flushes everything and frees the table */
+void db_close(Table* table);
+
+/* EXECUTE_DUPLICATE_KEY if the id is taken */
+ExecuteResult db_insert(Table* table, Row* row);
+/* false if there is no row with this id */
+bool db_get(Table* table, uint32_t id, Row* row);
+/* EXECUTE_KEY_NOT_FOUND if there is no row with this id */
+ExecuteResult db_delete(Table* table, uint32_t id);
+/*
+Replace the row with row->id in place; readers see the old row or the
+new one. EXECUTE_KEY_NOT_FOUND if there is no row with this id.
+*/
+ExecuteResult db_update(Table* table, Row* row);
+
+/* Rows with start <= id <= end */
+DbScan* db_scan_begin(Table* table, uint32_t start, uint32_t end);
+bool db_scan_next(DbScan* scan, Row* row);
+void db_scan_end(DbScan* scan);
+
+#endif
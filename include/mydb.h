@@ -3,12 +3,30 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cstdint>
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstdlib>
 #include <regex>
+#include <unordered_map>
+#include <algorithm>
+#include <climits>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <memory>
+#include <charconv>
+#include "wal.h"
+#include "page_io.h"
+#include "search.h"
+#include "parser.h"
+#include "api.h"
 
 typedef enum {
     META_COMMAND_SUCCESS,
@@ -25,17 +43,13 @@ typedef enum {
 typedef enum { 
     STATEMENT_INSERT,
     STATEMENT_CREATE,
-    STATEMENT_SELECT 
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_PREPARE,
+    STATEMENT_EXECUTE
 } StatementType;
 
-#define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
-typedef struct {
-    uint32_t id;
-    char username[COLUMN_USERNAME_SIZE+1];
-    char email[COLUMN_EMAIL_SIZE+1];
-} Row;
-
 #define COLUMN_MAX 20
 
 typedef enum {
@@ -48,12 +62,93 @@ typedef struct {
     std::vector<Type> colTypes;
 } TableSchema;
 
+/* Columns that can carry a secondary index */
+typedef enum {
+    INDEX_COLUMN_USERNAME,
+    INDEX_COLUMN_EMAIL,
+    INDEX_COLUMN_COUNT
+} IndexColumn;
+
 typedef struct {
     StatementType type;
     Row row_to_insert;
     TableSchema table_to_create;
+    uint32_t range_start;   // select/delete 的 id 范围，闭区间；start > end 表示空
+    uint32_t range_end;
+    bool single_row;        // delete <id>：行不存在时报错
+    uint64_t limit;         // select 最多返回的行数
+    IndexColumn column;     // create index 的列，或 select 的 where <column> = <value>
+    bool has_column_value;  // select 带有 <column> = <value> 条件
+    std::string column_value;
+    std::string name;       // prepare/execute 的语句名
+    std::string text;       // prepare 的语句正文
+    std::vector<std::string> arguments;  // execute 依次绑定的参数
 } Statement;
 
+/*
+ * Prepared statements
+ * prepared_init parses a statement once, with '?' standing for the values
+ * to be bound later: insert values, the value of a where condition, the
+ * limit, and the ids of a delete. Each '?' becomes a PreparedParam that
+ * records where its value goes, so a bind writes straight into the cached
+ * Statement (an insert's Row, say) and executing it parses nothing.
+ * Parameters are numbered from 0 in the order they appear. A bound value
+ * stays until it is bound again; a parameter never bound is 0 or empty.
+ */
+typedef enum {
+    PARAM_INSERT_ID,
+    PARAM_INSERT_USERNAME,
+    PARAM_INSERT_EMAIL,
+    PARAM_ID_CONDITION,     // select 的 id <op> ?
+    PARAM_COLUMN_VALUE,     // select 的 username/email = ?
+    PARAM_LIMIT,
+    PARAM_DELETE_ID,        // delete ?
+    PARAM_RANGE_START,      // delete where id between ? and <b>
+    PARAM_RANGE_END
+} ParamTarget;
+
+typedef struct {
+    ParamTarget target;
+    TokenType op;           // PARAM_ID_CONDITION 的比较符
+    uint32_t value;         // PARAM_ID_CONDITION 绑定的值
+} PreparedParam;
+
+typedef struct {
+    Statement statement;
+    std::vector<PreparedParam> params;
+    uint32_t range_start;   // select 里不带参数的 id 条件给出的范围
+    uint32_t range_end;
+} PreparedStatement;
+
+/*
+ * Result sinks
+ * execute_select hands its rows to a ResultSink, which formats them into a
+ * RESULT_SINK_BUFFER_SIZE buffer and passes the buffer to its stream when
+ * it fills up and when the select ends, rather than flushing the stream
+ * after every row. Formats:
+ *   RESULT_FORMAT_TEXT    (id, username, email), what the REPL prints
+ *   RESULT_FORMAT_TSV     id<TAB>username<TAB>email
+ *   RESULT_FORMAT_BINARY  the 4-byte id in host byte order, then the row as
+ *                         serialize_row encodes it: the username and email
+ *                         lengths, one byte each, and the two strings
+ * Text and TSV rows end with a newline. Values are written as they are,
+ * without escaping.
+ */
+#define RESULT_SINK_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    RESULT_FORMAT_TEXT,
+    RESULT_FORMAT_TSV,
+    RESULT_FORMAT_BINARY
+} ResultFormat;
+
+typedef struct {
+    std::ostream* out;
+    ResultFormat format;
+    uint32_t used;                          // buffer 里还没交给 out 的字节数
+    char buffer[RESULT_SINK_BUFFER_SIZE];
+} ResultSink;
+
 // (Struct*)0：将 0 转换为指向 Struct 类型的指针
 // ((Struct*)0)->Attribute：访问这个"假指针"指向的成员
 // sizeof(...)：计算该成员的大小
@@ -65,52 +160,226 @@ typedef struct {
 const uint32_t ID_SIZE = size_of_attribute(Row, id);
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
 const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
-#define TABLE_MAX_PAGES 100
+/*
+ * Row encoding
+ * A stored row is its two string lengths followed by the strings
+ * themselves, without padding or terminators. The id is not stored
+ * again since it is the key of the row's cell.
+ *
+ *   username_len (1) | email_len (1) | username | email
+ */
+const uint32_t ROW_LENGTHS_SIZE = 2 * sizeof(uint8_t);
+const uint32_t ROW_MAX_SIZE = ROW_LENGTHS_SIZE + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE;
+
 const uint32_t PAGE_SIZE = 4096;
-const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
+
+/*
+ * Buffer pool
+ * The pager caches at most num_frames pages. A page handed out by get_page
+ * stays pinned until the caller releases it with pager_unpin; only unpinned
+ * frames can be chosen as CLOCK victims, and only dirty victims are written back.
+ */
+#define PAGER_DEFAULT_NUM_FRAMES 1024
+#define PAGER_MIN_NUM_FRAMES 32
+
+/*
+ * Sequential read-ahead
+ * Leaf scans that keep moving forward through nearby page numbers are
+ * treated as sequential, each cursor tracking its own run; once
+ * PAGER_READAHEAD_TRIGGER such steps are seen
+ * the pager asks the kernel to start reading the next readahead_pages
+ * pages (posix_fadvise, or madvise in mmap mode) so the following
+ * get_page calls find them in the page cache instead of waiting on disk.
+ * When the buffered pager has io_uring, the window is instead read straight
+ * into buffer frames with pager_prefetch, never holding more than
+ * 1/PAGER_PREFETCH_POOL_FRACTION of the pool in outstanding reads.
+ */
+#define PAGER_DEFAULT_READAHEAD_PAGES 32
+#define PAGER_READAHEAD_TRIGGER 2
+#define PAGER_READAHEAD_MAX_GAP 8      // 叶子之间可能夹着内部节点页
+#define PAGER_PREFETCH_POOL_FRACTION 4
+
+/*
+ * user_data of a page I/O: write requests carry their page count, reads
+ * the frame index of their first page (the others follow via io_next)
+ */
+#define PAGER_PREFETCH_MAX_RUN 32
+#define PAGER_IO_WRITE_TAG (1ULL << 63)
+
+/*
+ * mmap mode
+ * get_page returns a pointer into a MAP_SHARED mapping of the db file and
+ * the kernel page cache is the only cache. The mapping lives inside a
+ * virtual address range reserved up front, so growing the file never
+ * moves pages that callers still hold pointers to.
+ * With the WAL the kernel may write back a page before its statement
+ * commits; a crash in the middle of a statement is not rolled back.
+ */
+#define PAGER_MMAP_RESERVE_BYTES (64ULL << 30)
+#define PAGER_MMAP_GROW_PAGES 256
+
+/*
+ * Concurrency
+ * Any number of threads may read the tree while one thread at a time
+ * changes it. The pager's own state (page table, CLOCK hand, frame
+ * flags, in-flight I/O) is guarded by Pager::mutex: cache hits only
+ * take it shared and pin the frame with an atomic increment, while
+ * misses, evictions and dirty tracking take it exclusively. A miss
+ * only holds it to claim a frame: the write-back of the page it held
+ * and the read of the new one happen without the lock, with the frame
+ * marked io_pending so that threads after either page wait for it.
+ *
+ * Page contents are guarded by a reader/writer latch per page, kept
+ * next to the frame (or, in mmap mode, in chunks that grow with the
+ * mapping). A latch may only be taken on a pinned page and must be
+ * released before the pin. Nobody waits for a latch while holding
+ * Pager::mutex.
+ */
+typedef enum {
+    LATCH_NONE,
+    LATCH_SHARED,
+    LATCH_EXCLUSIVE
+} LatchMode;
 
 typedef struct {
+    void* data;
+    uint32_t page_num;     // INVALID_PAGE_NUM 表示空闲帧
+    std::atomic<uint32_t> pin_count;
+    std::atomic<bool> referenced;   // CLOCK 引用位
+    bool dirty;            // 内存中的页与磁盘不一致
+    bool in_txn;           // 被当前语句修改、尚未写入 WAL，不能被淘汰
+    bool io_pending;       // 异步读尚未完成，读请求持有一个 pin
+    bool io_sync;          // io_pending 的 I/O 由 get_page 在锁外完成，等 io_done 而不是收割 pager->io
+    uint32_t io_next;      // 同一个读请求里的下一帧
+    std::shared_mutex latch;
+} Frame;
+
+typedef struct {
+    std::atomic<uint64_t> hits;    // 命中只持有共享锁，多个线程同时计数
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t write_backs;      // 淘汰时写回的脏页
+    uint64_t pages_written;
+    uint64_t write_calls;      // pwrite/pwritev 调用次数
+    uint64_t readahead_calls;
+    uint64_t readahead_pages;
+} PagerStats;
+
+typedef struct {
+    PagerMode mode;
     int file_descriptor;
-    uint32_t file_length;
+    off_t file_length;
     uint32_t num_pages;    // page的数量
-    void* pages[TABLE_MAX_PAGES];
+    uint32_t num_frames;
+    uint32_t num_used_frames;
+    uint32_t clock_hand;
+    Frame* frames;
+    std::unordered_map<uint32_t, uint32_t> page_table;  // page_num -> frame index
+    PagerStats stats;
+    Wal* wal;                             // NULL 表示不使用 WAL
+    std::vector<uint32_t> txn_pages;      // 当前语句修改过的页
+    char* map;                            // mmap 模式下预留区间的起点
+    off_t map_length;                     // 已映射的文件长度
+    uint32_t readahead_pages;             // 0 表示关闭预读
+    PageIo* io;                           // 批量读写，mmap 模式下为 NULL
+    uint32_t pending_reads;
+    uint32_t pending_writes;
+    uint32_t sync_write_backs;            // get_page 在锁外进行中的写回
+    std::shared_mutex mutex;              // 保护以上所有字段和帧的状态
+    std::condition_variable_any io_done;  // get_page 的锁外 I/O 完成时通知
+    std::vector<std::unique_ptr<std::shared_mutex[]>> map_latches;  // mmap 模式下每 PAGER_MMAP_GROW_PAGES 页一块
 } Pager;
 
 typedef struct {
+    uint64_t scans;
+    uint64_t rows;
+    uint64_t leaves;
+    uint64_t nanoseconds;
+    uint64_t index_lookups;    // 走二级索引的 select
+} ScanStats;
+
+/*
+ * Hash tables
+ * A table created with --hash keeps its rows in an extendible hash
+ * table instead of the B-tree: a directory of 2^global_depth bucket
+ * page numbers, indexed by the low bits of hash_id(id). Buckets are
+ * laid out exactly like leaves, so they are searched and filled the
+ * same way, and keep their local depth in the parent pointer word that
+ * leaves leave unused. A full bucket splits by the next hash bit,
+ * doubling the directory first when its local depth has reached the
+ * global depth. Buckets are never merged.
+ *
+ * The table's root page is the directory's meta page: it records the
+ * global depth and the directory pages, each a plain array of
+ * HASH_DIRECTORY_PAGE_ENTRIES bucket page numbers. The whole directory
+ * is also kept in memory, so a lookup reads a single page.
+ */
+const uint32_t HASH_DIRECTORY_PAGE_ENTRIES = PAGE_SIZE / sizeof(uint32_t);
+#define HASH_MAX_GLOBAL_DEPTH 19       // 2^19 个目录项占 512 个目录页，元数据页放得下
+
+typedef struct {
+    uint32_t global_depth;
+    std::vector<uint32_t> buckets;          // hash 的低 global_depth 位 -> 桶的页号
+    std::vector<uint32_t> directory_pages;
+    std::shared_mutex mutex;                // 读者查目录时共享持有，分裂桶时独占
+} HashDirectory;
+
+typedef struct Table {
     Pager* pager;
-    uint32_t root_page_num;
+    TableOrganization organization;
+    HashDirectory* hash;                  // 只有哈希表有
+    std::atomic<uint32_t> root_page_num;  // 只有批量导入会换根
+    uint32_t internal_node_max_cells;
+    ScanStats scan_stats;
+    std::mutex scan_stats_mutex;
+    std::mutex writer_mutex;              // 同一时刻只有一条写语句
+    std::atomic<struct Table*> indexes[INDEX_COLUMN_COUNT];  // 二级索引的树，NULL 表示没有建
 } Table;
 
-typedef enum { 
-    EXECUTE_SUCCESS,
-    EXECUTE_DUPLICATE_KEY, 
-    EXECUTE_TABLE_FULL,
-    EXECUTE_UNKNOWN_COMMAND 
-} ExecuteResult;
+/*
+ * Nodes do not keep a usable parent pointer: table_find records the
+ * internal nodes it passed on the way down, and which child it took in
+ * each, and splits walk back up that path. Moving children to a new node
+ * therefore never has to touch (and dirty) the children themselves, and
+ * a split knows its slot in the parent without searching for it.
+ *
+ * Readers descend with latch coupling: the child is latched shared
+ * before the parent is released, and a scan moves along the leaves
+ * the same way, always left to right. The writer first descends like
+ * a reader but latches the leaf exclusively; if the leaf might split
+ * (insert) or underflow (delete) and so change its parent, it descends
+ * again with exclusive latches, keeping those of the nodes above only
+ * while the node below is unsafe in that sense. The cursor keeps every
+ * latch it still holds until cursor_close.
+ */
+#define BTREE_MAX_HEIGHT 32
 
 typedef struct {
   Table* table;
   uint32_t page_num;
   uint32_t cell_num;
   bool end_of_table;  // Indicates a position one past the last element
+  uint32_t depth;                          // 叶子上面的内部节点数
+  uint32_t ancestors[BTREE_MAX_HEIGHT];    // 从根到叶子的父节点
+  uint32_t child_indexes[BTREE_MAX_HEIGHT];  // 在 ancestors[i] 中走的是第几个孩子
+  LatchMode latch_mode;                    // 叶子和 latched_from 以下的祖先上持有的 latch
+  uint32_t latched_from;                   // ancestors[latched_from, depth) 仍被锁住并 pin 住
+  uint32_t sequential_run;                 // 连续向前走到附近叶子的次数
+  uint32_t readahead_end;                  // 这个游标已经预读到的位置（不含）
 } Cursor;
 
 typedef enum { 
     NODE_INTERNAL, 
-    NODE_LEAF 
+    NODE_LEAF,
+    NODE_HASH_DIRECTORY
 } NodeType;
 
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
+const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);     // 不再维护，只保留文件布局
 const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 const uint32_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
 
@@ -122,21 +391,62 @@ const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEAP_START_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_HEAP_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_HEAP_START_SIZE;
+
+/*
+ * Node bodies start on a 16-byte boundary so the key arrays can be
+ * loaded with aligned vector instructions.
+ */
+const uint32_t NODE_BODY_ALIGNMENT = 16;
 
 /*
  * Leaf Node Body Layout
+ * Leaves are slotted pages. The keys stay in one dense array right
+ * after the header so a search still only touches them; the slot
+ * array after it holds each row's offset within the page, and the
+ * rows themselves fill a heap that grows down from the end of the page.
+ *
+ *   header | key[0..num_cells) | slot[0..num_cells) | free | rows
+ *
+ * Adding a cell shifts the slot array by one key. A deleted row leaves
+ * a hole in the heap; holes are only squeezed out when an insert does
+ * not fit into the gap between slots and heap. A leaf therefore holds
+ * as many rows as their actual lengths allow instead of a fixed count,
+ * and splits and merges balance bytes rather than cells.
  */
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CELL_OVERHEAD = LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+const uint32_t LEAF_NODE_KEYS_OFFSET =
+    (LEAF_NODE_HEADER_SIZE + NODE_BODY_ALIGNMENT - 1) / NODE_BODY_ALIGNMENT * NODE_BODY_ALIGNMENT;
+const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_KEYS_OFFSET;
+const uint32_t LEAF_NODE_MAX_CELL_SIZE = LEAF_NODE_CELL_OVERHEAD + ROW_MAX_SIZE;
 
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+/*
+ * Deletion
+ * A node left less than half full (in bytes, for leaves) by a delete is rebalanced with an
+ * adjacent sibling under the same parent: when both fit in one node
+ * the right one is merged into the left and freed, otherwise cells move
+ * across until both are about equally full. A merge takes a key out of the
+ * parent, which can leave it underfull in turn, so this repeats up the
+ * path recorded by table_find; a root left with a single child absorbs
+ * that child. Separator keys stay valid upper bounds when a row is
+ * removed, so a delete without underflow never touches the parent.
+ */
+const uint32_t LEAF_NODE_MIN_SPACE = LEAF_NODE_SPACE_FOR_CELLS / 2;
+#define DELETE_RANGE_COMMIT_PAGES 64   // 范围删除每攒够这么多脏页就提交一次
+
+/*
+ * Hash Directory Meta Page Layout
+ */
+const uint32_t HASH_META_GLOBAL_DEPTH_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t HASH_META_NUM_DIRECTORY_PAGES_OFFSET = HASH_META_GLOBAL_DEPTH_OFFSET + sizeof(uint32_t);
+const uint32_t HASH_META_DIRECTORY_PAGES_OFFSET = HASH_META_NUM_DIRECTORY_PAGES_OFFSET + sizeof(uint32_t);
+const uint32_t HASH_META_MAX_DIRECTORY_PAGES =
+    (PAGE_SIZE - HASH_META_DIRECTORY_PAGES_OFFSET) / sizeof(uint32_t);
 
 /*
  * Internal Node Header Layout
@@ -150,74 +460,237 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NO
 
 /*
  * Internal Node Body Layout
+ * Like leaves, keys are kept in their own array ahead of the child
+ * pointers; key[i] is the max key under child[i]. The right child is
+ * in the header and has no key.
+ *
+ *   header | pad | key[0..MAX_CELLS) | child[0..MAX_CELLS)
  */
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_KEYS_OFFSET =
+    (INTERNAL_NODE_HEADER_SIZE + NODE_BODY_ALIGNMENT - 1) / NODE_BODY_ALIGNMENT * NODE_BODY_ALIGNMENT;
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_KEYS_OFFSET;
+const uint32_t INTERNAL_NODE_MAX_CELLS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+const uint32_t INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_KEYS_OFFSET + INTERNAL_NODE_MAX_CELLS * INTERNAL_NODE_KEY_SIZE;
 
-/* Keep this small for testing */
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+/*
+ * Tests can lower the fan-out with --internal-node-max-cells so that a
+ * few dozen rows already produce internal node splits. It only limits
+ * how full nodes get and is not stored in the file.
+ */
+const uint32_t INTERNAL_NODE_MIN_MAX_CELLS = 2;
 
 #define INVALID_PAGE_NUM UINT32_MAX
 
+/*
+ * Database Header Page Layout
+ * Page 0 identifies the file and records how the table is organized,
+ * where its root, the roots of the secondary indexes (0 when a column
+ * has none) and the freelist are. Since page 0 is never a tree node, a next-leaf or freelist
+ * pointer of 0 still means "none".
+ */
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+const uint32_t DB_HEADER_MAGIC = 0x6264796d;  // "mydb"
+const uint32_t DB_FORMAT_VERSION = 3;     // 2: 节点的 key 单独连续存放；3: 变长行、叶子改为 slotted page
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_VERSION_OFFSET = DB_HEADER_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_VERSION_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREELIST_TRUNK_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREELIST_COUNT_OFFSET = DB_HEADER_FREELIST_TRUNK_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_INDEX_ROOTS_OFFSET = DB_HEADER_FREELIST_COUNT_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_ORGANIZATION_OFFSET = DB_HEADER_INDEX_ROOTS_OFFSET + INDEX_COLUMN_COUNT * sizeof(uint32_t);
+
+/*
+ * Freelist Trunk Page Layout
+ * Free pages form a chain of trunk pages; each trunk lists leaf free pages
+ * whose contents are meaningless. Allocation takes a leaf of the first
+ * trunk, or the trunk itself once it has no leaves left.
+ */
+const uint32_t FREELIST_TRUNK_NEXT_OFFSET = 0;
+const uint32_t FREELIST_TRUNK_NUM_LEAVES_OFFSET = FREELIST_TRUNK_NEXT_OFFSET + sizeof(uint32_t);
+const uint32_t FREELIST_TRUNK_LEAVES_OFFSET = FREELIST_TRUNK_NUM_LEAVES_OFFSET + sizeof(uint32_t);
+const uint32_t FREELIST_TRUNK_MAX_LEAVES = (PAGE_SIZE - FREELIST_TRUNK_LEAVES_OFFSET) / sizeof(uint32_t);
+
+/*
+ * Secondary indexes
+ * An index on username or email is a second B-tree in the same file,
+ * made of the same nodes as the table and found through its own Table
+ * handle. Since keys are 32-bit, an index is keyed by a hash of the
+ * column value, and each cell lists the ids of the rows under that key.
+ * A list starts with two length bytes like a row, so leaves size its
+ * cell the same way:
+ *
+ *   ids_len (1) | next_len (1) | id[0..n) | next key (next_len)
+ *
+ * Once a list holds INDEX_LIST_MAX_IDS ids, further ids go to the list
+ * of the next key and the full one records that key so that lookups
+ * follow it. A lookup therefore returns candidate ids, which are
+ * checked against the rows themselves; this also takes care of hash
+ * collisions.
+ */
+const uint32_t INDEX_LIST_MAX_IDS = UINT8_MAX / sizeof(uint32_t);
+
+/*
+ * Bulk loading
+ * Rows sorted by key are appended left to right into fresh leaves, each
+ * filled to fill_percent of its capacity. Internal levels are built in
+ * the same pass: every level keeps one open node that collects the nodes
+ * closed below it, and a full node is closed into the level above. The
+ * new tree only becomes visible when bulk_load_finish points the header
+ * at its root, so an aborted load just returns its pages to the freelist.
+ */
+#define BULK_LOAD_DEFAULT_FILL_PERCENT 90
+#define BULK_LOAD_COMMIT_PAGES 64      // 每攒够这么多脏页就提交一次，避免占满缓冲池
+
+typedef struct {
+    uint32_t page_num;        // 当前打开的节点，INVALID_PAGE_NUM 表示还没有
+    uint32_t num_children;
+    uint32_t max_key;
+} BulkLoadLevel;
+
+typedef struct {
+    Table* table;
+    uint32_t leaf_capacity;              // 每个叶子填充的字节数
+    uint32_t internal_capacity;          // 每个内部节点的孩子数
+    uint32_t leaf_page_num;
+    uint32_t leaf_num_cells;
+    uint32_t leaf_used;                  // 当前叶子已用的字节数
+    uint32_t last_key;
+    uint64_t num_rows;
+    std::vector<BulkLoadLevel> levels;   // levels[0] 是叶子的父层
+    std::vector<uint32_t> pages;         // 分配过的页，放弃时归还
+} BulkLoader;
+
 void print_prompt();
-PrepareResult prepare_statement(std::string input_buffer, Statement* statement);
-ExecuteResult execute_statement(Statement* statement, Table* table);
+PrepareResult prepare_statement(std::string_view input, Statement* statement);
+PrepareResult prepared_init(std::string_view input, PreparedStatement* prepared);
+PrepareResult prepared_bind_int(PreparedStatement* prepared, uint32_t index, uint64_t value);
+PrepareResult prepared_bind_text(PreparedStatement* prepared, uint32_t index, std::string_view value);
+ExecuteResult prepared_execute(PreparedStatement* prepared, Table* table, ResultSink* sink);
+ExecuteResult execute_statement(Statement* statement, Table* table, ResultSink* sink);
 MetaCommandResult do_meta_command(std::string input_buffer, Table* table);
-void serialize_row(Row* source, void* destination);
-void deserialize_row(void* source, Row* destination);
-void* cursor_value(Cursor* cursor);
+uint32_t row_encoded_size(Row* row);
+uint32_t serialize_row(Row* source, void* destination);
+uint32_t deserialize_row(void* source, Row* destination);
+void cursor_row(Cursor* cursor, Row* row);
 ExecuteResult execute_insert(Statement* statement, Table* table);
-ExecuteResult execute_select(Statement* statement, Table* table);
+ExecuteResult execute_select(Statement* statement, Table* table, ResultSink* sink);
+ExecuteResult execute_delete(Statement* statement, Table* table);
 void print_row(Row* row);
-Pager* pager_open(const char* filename);
-Table* db_open(const char* filename);
+void result_sink_init(ResultSink* sink, std::ostream* out, ResultFormat format);
+void result_sink_row(ResultSink* sink, Row* row);
+void result_sink_flush(ResultSink* sink);
+Pager* pager_open(const char* filename, DbOptions* options);
 void* get_page(Pager* pager, uint32_t page_num);
-void db_close(Table* table);
-void pager_flush(Pager* pager, uint32_t page_num);
+void pager_unpin(Pager* pager, uint32_t page_num);
+void pager_mark_dirty(Pager* pager, uint32_t page_num);
+uint32_t pager_find_victim(Pager* pager);
+void pager_flush_all(Pager* pager);
+void pager_commit(Pager* pager);
+void pager_commit_partial(Pager* pager, uint32_t max_pages);
+void pager_checkpoint(Pager* pager);
+void print_pager_stats(Pager* pager);
+void print_scan_stats(Table* table);
+BulkLoader* bulk_load_begin(Table* table, uint32_t fill_percent);
+ExecuteResult bulk_load_add(BulkLoader* loader, uint32_t key, Row* row);
+void bulk_load_finish(BulkLoader* loader);
+void bulk_load_abort(BulkLoader* loader);
+ExecuteResult bulk_load_file(Table* table, const char* path, uint32_t fill_percent, uint64_t* num_rows);
+void cursor_readahead(Cursor* cursor, uint32_t page_num);
+uint32_t pager_prefetch(Pager* pager, const uint32_t* page_nums, uint32_t count);
+void pager_wait_io(Pager* pager);
+void pager_latch(Pager* pager, uint32_t page_num, LatchMode mode);
+void pager_unlatch(Pager* pager, uint32_t page_num, LatchMode mode);
 Cursor* table_start(Table* table);
+void cursor_settle(Cursor* cursor);
 void cursor_advance(Cursor* cursor);
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value);
+void cursor_close(Cursor* cursor);
+void leaf_node_insert(Cursor* cursor, uint32_t key, const void* value, uint32_t size);
+bool leaf_node_delete(Cursor* cursor);
+bool btree_rebalance(Cursor* cursor, uint32_t level);
+void btree_rebalance_leaf(Table* table, uint32_t key);
 void print_constants();
 // void print_leaf_node(void* node);
 uint32_t* leaf_node_num_cells(void* node);
-void* leaf_node_cell(void* node, uint32_t cell_num);
 uint32_t* leaf_node_key(void* node, uint32_t cell_num);
+uint16_t* leaf_node_heap_start(void* node);
+uint16_t* leaf_node_slot(void* node, uint32_t cell_num);
 void* leaf_node_value(void* node, uint32_t cell_num);
+uint32_t leaf_node_value_size(void* node, uint32_t cell_num);
+uint32_t leaf_node_used_space(void* node);
+bool leaf_node_insert_cell(void* node, uint32_t cell_num, uint32_t key, const void* value, uint32_t size);
+bool leaf_node_update_cell(void* node, uint32_t cell_num, const void* value, uint32_t size);
+void leaf_node_remove_cell(void* node, uint32_t cell_num);
+void leaf_node_compact(void* node);
+void leaf_node_move_cells(void* destination, uint32_t destination_cell,
+                          void* source, uint32_t source_cell, uint32_t count);
 void initialize_leaf_node(void* node);
 void print_page(Pager* pager, uint32_t page_num);
 Cursor* table_find(Table* table, uint32_t key);
+Cursor* table_find_for_write(Table* table, uint32_t key, StatementType op);
+bool table_lookup(Table* table, uint32_t key, Row* row);
+ExecuteResult table_update(Table* table, Row* row);
 Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key);
 void set_node_type(void* node, NodeType type);
 NodeType get_node_type(void* node);
 void initialize_leaf_node(void* node);
 uint32_t get_unused_page_num(Pager* pager);
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value);
-void create_new_root(Table* table, uint32_t right_child_page_num);
+void free_page(Pager* pager, uint32_t page_num);
+uint32_t pager_truncate_free_pages(Pager* pager);
+void print_freelist_stats(Pager* pager);
+void pager_truncate(Pager* pager, uint32_t num_pages);
+uint32_t* db_header_magic(void* header);
+uint32_t* db_header_version(void* header);
+uint32_t* db_header_root_page(void* header);
+uint32_t* db_header_freelist_trunk(void* header);
+uint32_t* db_header_freelist_count(void* header);
+uint32_t* db_header_index_root(void* header, IndexColumn column);
+uint32_t* db_header_organization(void* header);
+uint32_t* freelist_trunk_next(void* trunk);
+uint32_t* freelist_trunk_num_leaves(void* trunk);
+uint32_t* freelist_trunk_leaf(void* trunk, uint32_t leaf_num);
+void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, const void* value, uint32_t size);
+void create_new_root(Table* table, uint32_t right_child_page_num, uint32_t left_child_max_key);
 uint32_t* internal_node_key(void* node, uint32_t key_num);
 uint32_t* internal_node_child(void* node, uint32_t child_num);
-uint32_t* internal_node_cell(void* node, uint32_t cell_num);
+void internal_node_move_cells(void* destination, uint32_t destination_cell,
+                              void* source, uint32_t source_cell, uint32_t count);
 uint32_t* internal_node_right_child(void* node);
 uint32_t* internal_node_num_keys(void* node);
-uint32_t get_node_max_key(Pager* pager, void* node);
 bool is_node_root(void* node);
 void set_node_root(void* node, bool is_root);
 void initialize_internal_node(void* node);
 void indent(uint32_t level);
 void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level);
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key);
 uint32_t* leaf_node_next_leaf(void* node);
-uint32_t* node_parent(void* node);
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key);
 uint32_t internal_node_find_child(void* node, uint32_t key);
-void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
-void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
+void internal_node_insert(Cursor* cursor, uint32_t level, uint32_t left_max, uint32_t right_page_num);
+void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t left_max, uint32_t right_page_num);
 std::string ltrim(const std::string& s);
 std::string rtrim(const std::string& s);
 std::string trim(const std::string& s);
 std::vector<std::string> split(const std::string& str, char delimiter);
 std::vector<std::string> splitAndRemoveEmptyString(const std::string& str, char delimiter);
 ExecuteResult execute_create(Statement* statement, Table* table);
+ExecuteResult execute_create_index(Statement* statement, Table* table);
+const char* index_column_value(Row* row, IndexColumn column);
+uint32_t index_hash(const char* value);
+void index_insert(Table* index, const char* value, uint32_t id);
+void index_delete(Table* index, const char* value, uint32_t id);
+void index_lookup(Table* index, const char* value, std::vector<uint32_t>* ids);
+void index_build(Table* table, Table* index, IndexColumn column);
+uint32_t hash_id(uint32_t id);
+uint32_t* hash_bucket_local_depth(void* bucket);
+uint32_t hash_create(Pager* pager);
+HashDirectory* hash_open(Pager* pager, uint32_t meta_page_num);
+bool hash_lookup(Table* table, uint32_t key, Row* row);
+ExecuteResult hash_insert(Table* table, Row* row);
+ExecuteResult hash_update(Table* table, Row* row, Row* old_row);
+bool hash_delete(Table* table, uint32_t key, Row* row);
+void hash_collect(Table* table, uint32_t start, uint32_t end, std::vector<Row>* rows);
+void print_hash_table(Table* table);
 
 
 #endif
\ No newline at end of file
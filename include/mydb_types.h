@@ -0,0 +1,58 @@
+#ifndef MYDB_TYPES_H
+#define MYDB_TYPES_H
+
+#include <cstdint>
+
+/*
+ * Types shared by the engine and the embedding API. An embedder sees
+ * these and api.h only; Table stays opaque outside the engine.
+ */
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+typedef struct {
+    uint32_t id;
+    char username[COLUMN_USERNAME_SIZE+1];
+    char email[COLUMN_EMAIL_SIZE+1];
+} Row;
+
+typedef enum {
+    PAGER_BUFFERED,
+    PAGER_MMAP
+} PagerMode;
+
+typedef enum {
+    WAL_SYNC_NORMAL,    // 写入 WAL 即返回，后台线程按间隔批量 fsync
+    WAL_SYNC_FULL       // 等待覆盖本次提交的 fsync 完成后再返回
+} WalSyncMode;
+
+/* How a table stores its rows; fixed when the db file is created */
+typedef enum {
+    TABLE_BTREE,
+    TABLE_HASH
+} TableOrganization;
+
+typedef struct {
+    PagerMode mode;
+    uint32_t num_frames;
+    bool use_wal;
+    WalSyncMode wal_sync;
+    uint32_t group_commit_ms;
+    uint32_t readahead_pages;
+    bool use_uring;
+    uint32_t internal_node_max_cells;     // 0 表示按页大小计算
+    TableOrganization organization;       // 只在新建文件时使用，之后以文件头为准
+} DbOptions;
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_UNKNOWN_COMMAND,
+    EXECUTE_UNSORTED_KEY,
+    EXECUTE_KEY_NOT_FOUND,
+    EXECUTE_INDEX_EXISTS
+} ExecuteResult;
+
+typedef struct Table Table;    // 定义在 mydb.h
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef PAGE_IO_H
+#define PAGE_IO_H
+
+#include <cstdint>
+#include <deque>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * Batched page I/O
+ * Requests are queued with page_io_queue and handed to the kernel
+ * together by page_io_submit; completions come back through page_io_reap
+ * in any order and are matched by user_data.
+ *
+ * With io_uring a batch costs one io_uring_enter however many pages it
+ * covers, and reads can stay in flight while the caller keeps working.
+ * When io_uring is unavailable (old kernel, disabled by sysctl or
+ * seccomp, or --no-uring) each request runs as a blocking preadv/pwritev
+ * at queue time and its completion is held until reaped, so callers use
+ * the same interface either way.
+ *
+ * Only rings with IORING_FEAT_SUBMIT_STABLE are used, so an iovec array
+ * need only live until page_io_submit returns; the buffers it points to
+ * must live until the request is reaped.
+ */
+#define PAGE_IO_QUEUE_DEPTH 64
+
+typedef enum {
+    PAGE_IO_READ,
+    PAGE_IO_WRITE
+} PageIoOp;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t result;         // 传输的字节数，出错时为 -errno
+} PageIoCompletion;
+
+typedef struct {
+    uint64_t submits;       // io_uring_enter 或 preadv/pwritev 的调用次数
+    uint64_t reads;
+    uint64_t writes;
+} PageIoStats;
+
+typedef struct {
+    bool uring;             // false 表示同步回退
+    uint32_t depth;
+    uint32_t queued;        // 已放入 SQ、尚未提交
+    uint32_t in_flight;     // 已提交、尚未收割
+
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    std::deque<PageIoCompletion> completed;  // 同步回退模式下已完成的请求
+    PageIoStats stats;
+} PageIo;
+
+PageIo* page_io_open(uint32_t depth, bool try_uring);
+void page_io_close(PageIo* io);
+uint32_t page_io_free_slots(PageIo* io);
+void page_io_queue(PageIo* io, PageIoOp op, int fd, const struct iovec* iov, int iovcnt,
+                   off_t offset, uint64_t user_data);
+void page_io_submit(PageIo* io);
+bool page_io_reap(PageIo* io, PageIoCompletion* completion, bool wait);
+void print_page_io_stats(PageIo* io);
+
+#endif
@@ -1,6 +1,67 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <cstddef>
+#include <string_view>
 
+/*
+ * Statement lexer
+ * prepare_statement parses a line in a single pass: a recursive-descent
+ * parser pulls tokens one at a time from the lexer, keeping one token of
+ * lookahead, and fills in the Statement as it goes. Tokens are slices of
+ * the input line, so nothing is copied until a value lands in the
+ * Statement.
+ *
+ * Inserted values and the value of a username/email condition are taken
+ * as raw words instead: everything up to the next whitespace, so emails
+ * and other punctuation need no quoting.
+ *
+ * Grammar (keywords are lowercase):
+ *   insert <id> <word> <word>
+ *   select [where <condition> {and <condition>}] [limit <n>]
+ *   delete <id> | delete where id between <id> and <id>
+ *   create table <name> ( <column> INT|STRING {, <column> INT|STRING} )
+ *   create index on <name> ( username|email )
+ *   <condition> := id =|<|<=|>|>= <id> | username = <word> | email = <word>
+ * Any statement but insert may end with a ';'.
+ *
+ * The REPL also takes
+ *   prepare <name> as <statement>
+ *   execute <name> {<word>}
+ * where the prepared statement may use '?' in place of any <id>, <word>
+ * or <n> above.
+ */
+typedef enum {
+    TOKEN_END,
+    TOKEN_IDENTIFIER,       // 字母、数字和 '_'，不以数字开头
+    TOKEN_NUMBER,           // 十进制数字
+    TOKEN_LEFT_PAREN,
+    TOKEN_RIGHT_PAREN,
+    TOKEN_COMMA,
+    TOKEN_SEMICOLON,
+    TOKEN_EQUAL,
+    TOKEN_LESS,
+    TOKEN_LESS_EQUAL,
+    TOKEN_GREATER,
+    TOKEN_GREATER_EQUAL,
+    TOKEN_PARAMETER,        // prepared statement 里的 '?'
+    TOKEN_OTHER             // 其他单个字符
+} TokenType;
 
-#endif
\ No newline at end of file
+typedef struct {
+    TokenType type;
+    std::string_view text;  // 指向输入行，不拷贝
+} Token;
+
+typedef struct {
+    std::string_view input;
+    size_t pos;
+} Lexer;
+
+void lexer_init(Lexer* lexer, std::string_view input);
+Token lexer_next(Lexer* lexer);
+
+/* The next run of non-whitespace characters, empty at the end of the input */
+std::string_view lexer_next_word(Lexer* lexer);
+
+#endif
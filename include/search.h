@@ -0,0 +1,30 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <cstdint>
+
+/*
+ * Key search within a node
+ * Leaves and internal nodes keep their keys in one dense sorted array,
+ * so a search is a lower bound over a few hundred bytes at most.
+ *
+ * search_lower_bound halves the range with a branchless binary search
+ * until at most SEARCH_LINEAR_KEYS keys remain, then counts the keys
+ * below the target with vector compares: AVX2 when the CPU has it
+ * (checked once at startup), SSE2 otherwise, and plain C off x86.
+ * Counting needs no branches on the data. A leaf holds anywhere from a
+ * dozen of the widest rows to a few hundred short ones, so at most a few
+ * halving steps come before the branch-free count.
+ */
+#define SEARCH_LINEAR_KEYS 32
+
+/* Index of the first key >= key, or num_keys when every key is smaller */
+uint32_t search_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+
+/* The textbook binary search, kept as the baseline for bench_search */
+uint32_t search_lower_bound_scalar(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+
+/* "avx2", "sse2" or "scalar" */
+const char* search_implementation();
+
+#endif
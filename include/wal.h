@@ -0,0 +1,96 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include "mydb_types.h"
+
+/*
+ * Write-ahead log
+ * Each statement that changed pages appends an image of every page it
+ * dirtied to <db>-wal; the last frame of a statement is the commit frame
+ * and records the database size in pages. Frames carry a checksum chained
+ * over everything before them, so a torn tail is detected on recovery and
+ * only fully committed statements are replayed.
+ *
+ * WAL file layout:
+ *   header | frame header + page | frame header + page | ...
+ */
+const uint32_t WAL_MAGIC = 0x6d794442;  // "myDB"
+const uint32_t WAL_VERSION = 1;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t salt;      // 每次 checkpoint 后递增，旧的帧因此失效
+    uint32_t checksum;
+} WalHeader;
+
+typedef struct {
+    uint32_t page_num;
+    uint32_t db_size;   // commit 帧记录提交后的总页数，其他帧为 0
+    uint32_t salt;
+    uint32_t checksum;  // 覆盖之前所有帧的累积校验和
+} WalFrameHeader;
+
+const uint32_t WAL_HEADER_SIZE = sizeof(WalHeader);
+const uint32_t WAL_FRAME_HEADER_SIZE = sizeof(WalFrameHeader);
+
+/* Checkpoint once the log holds this many frames (about 4 MB) */
+#define WAL_CHECKPOINT_FRAMES 1000
+#define WAL_DEFAULT_GROUP_COMMIT_MS 10
+
+typedef struct {
+    uint64_t commits;
+    uint64_t frames;
+    uint64_t syncs;
+    uint64_t checkpoints;
+    uint64_t recovered_frames;
+} WalStats;
+
+typedef struct {
+    int file_descriptor;
+    std::string path;
+    uint32_t page_size;
+    uint32_t salt;
+    uint32_t checksum;        // 最后一帧的累积校验和
+    off_t file_size;
+    uint32_t num_frames;
+    WalSyncMode sync_mode;
+    uint32_t group_commit_ms;
+
+    /*
+    LSNs are byte counts that keep growing across checkpoints.
+    The flusher thread fsyncs everything written so far and advances
+    synced_lsn; committers in WAL_SYNC_FULL mode wait on synced.
+    */
+    std::mutex mutex;
+    std::condition_variable sync_requested;
+    std::condition_variable synced;
+    uint64_t written_lsn;
+    uint64_t synced_lsn;
+    uint32_t waiters;
+    bool stop;
+    std::thread flusher;
+
+    WalStats stats;
+} Wal;
+
+Wal* wal_open(const char* db_filename, int db_file_descriptor, uint32_t page_size,
+              WalSyncMode sync_mode, uint32_t group_commit_ms);
+void wal_close(Wal* wal);
+uint32_t wal_recover(Wal* wal, int db_file_descriptor);
+uint64_t wal_commit(Wal* wal, const uint32_t* page_nums, void* const* pages,
+                    uint32_t count, uint32_t db_size);
+void wal_wait_synced(Wal* wal, uint64_t lsn);
+void wal_sync(Wal* wal);
+void wal_reset(Wal* wal);
+uint32_t wal_checksum(const void* data, size_t size, uint32_t seed);
+void print_wal_stats(Wal* wal);
+
+#endif
@@ -0,0 +1,110 @@
+#include "mydb.h"
+
+using namespace std;
+
+struct DbScan {
+    Table* table;
+    uint32_t next_id;       // 下一批从这个 id 开始找
+    uint32_t end_id;
+    bool done;              // 后面没有要找的行了
+    vector<Row> rows;       // 当前这一批
+    size_t pos;
+};
+
+ExecuteResult db_insert(Table* table, Row* row) {
+    Statement statement;
+    statement.type = STATEMENT_INSERT;
+    statement.row_to_insert = *row;
+    return execute_statement(&statement, table, NULL);
+}
+
+bool db_get(Table* table, uint32_t id, Row* row) {
+    return table_lookup(table, id, row);
+}
+
+ExecuteResult db_delete(Table* table, uint32_t id) {
+    Statement statement;
+    statement.type = STATEMENT_DELETE;
+    statement.range_start = id;
+    statement.range_end = id;
+    statement.single_row = true;
+    return execute_statement(&statement, table, NULL);
+}
+
+ExecuteResult db_update(Table* table, Row* row) {
+    lock_guard<mutex> writer_lock(table->writer_mutex);
+    ExecuteResult result = table_update(table, row);
+    // 没改动时没有要提交的页
+    if (result == EXECUTE_SUCCESS) {
+        pager_commit(table->pager);
+    }
+    return result;
+}
+
+DbScan* db_scan_begin(Table* table, uint32_t start, uint32_t end) {
+    DbScan* scan = new DbScan();
+    scan->table = table;
+    scan->next_id = start;
+    scan->end_id = end;
+    scan->done = start > end;
+    scan->pos = 0;
+    return scan;
+}
+
+/*
+Copy the next batch of rows: the rest of the leaf holding next_id, found
+from the root each time so that no latch outlives the call. A hash table
+has no order to resume from and hands over the whole range at once.
+*/
+static void db_scan_fill(DbScan* scan) {
+    scan->rows.clear();
+    scan->pos = 0;
+    if (scan->done) {
+        return;
+    }
+    Table* table = scan->table;
+    if (table->organization == TABLE_HASH) {
+        hash_collect(table, scan->next_id, scan->end_id, &scan->rows);
+        scan->done = true;
+        return;
+    }
+    Cursor* cursor = table_find(table, scan->next_id);
+    cursor_settle(cursor);
+    uint32_t page_num = cursor->page_num;
+    Row row;
+    while (!cursor->end_of_table && cursor->page_num == page_num) {
+        cursor_row(cursor, &row);
+        if (row.id > scan->end_id) {
+            scan->done = true;
+            break;
+        }
+        scan->rows.push_back(row);
+        cursor_advance(cursor);
+    }
+    if (cursor->end_of_table) {
+        scan->done = true;
+    }
+    cursor_close(cursor);
+    if (!scan->rows.empty()) {
+        uint32_t last_id = scan->rows.back().id;
+        if (last_id == UINT32_MAX) {
+            scan->done = true;
+        }
+        scan->next_id = last_id + 1;
+    }
+}
+
+bool db_scan_next(DbScan* scan, Row* row) {
+    if (scan->pos == scan->rows.size()) {
+        db_scan_fill(scan);
+        if (scan->rows.empty()) {
+            return false;
+        }
+    }
+    *row = scan->rows[scan->pos++];
+    return true;
+}
+
+void db_scan_end(DbScan* scan) {
+    delete scan;
+}
@@ -0,0 +1,337 @@
+#include "mydb.h"
+
+using namespace std;
+
+/* murmur3's finalizer: a bijection on 32 bits, so two ids never share a hash */
+uint32_t hash_id(uint32_t id) {
+    id ^= id >> 16;
+    id *= 0x85ebca6b;
+    id ^= id >> 13;
+    id *= 0xc2b2ae35;
+    id ^= id >> 16;
+    return id;
+}
+
+static uint32_t* hash_meta_global_depth(void* meta) {
+    return (uint32_t*)((char*)meta + HASH_META_GLOBAL_DEPTH_OFFSET);
+}
+static uint32_t* hash_meta_num_directory_pages(void* meta) {
+    return (uint32_t*)((char*)meta + HASH_META_NUM_DIRECTORY_PAGES_OFFSET);
+}
+static uint32_t* hash_meta_directory_page(void* meta, uint32_t index) {
+    return (uint32_t*)((char*)meta + HASH_META_DIRECTORY_PAGES_OFFSET) + index;
+}
+uint32_t* hash_bucket_local_depth(void* bucket) {
+    return (uint32_t*)((char*)bucket + PARENT_POINTER_OFFSET);
+}
+
+static uint32_t hash_bucket_page(HashDirectory* directory, uint32_t key) {
+    return directory->buckets[hash_id(key) & ((1u << directory->global_depth) - 1)];
+}
+
+static uint32_t hash_new_bucket(Pager* pager, uint32_t local_depth) {
+    uint32_t page_num = get_unused_page_num(pager);
+    void* bucket = get_page(pager, page_num);
+    initialize_leaf_node(bucket);
+    *hash_bucket_local_depth(bucket) = local_depth;
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+    return page_num;
+}
+
+/* Write the meta page: global depth and the list of directory pages */
+static void hash_write_meta(Pager* pager, uint32_t meta_page_num, HashDirectory* directory) {
+    void* meta = get_page(pager, meta_page_num);
+    *hash_meta_global_depth(meta) = directory->global_depth;
+    *hash_meta_num_directory_pages(meta) = directory->directory_pages.size();
+    for (uint32_t i = 0; i < directory->directory_pages.size(); i++) {
+        *hash_meta_directory_page(meta, i) = directory->directory_pages[i];
+    }
+    pager_mark_dirty(pager, meta_page_num);
+    pager_unpin(pager, meta_page_num);
+}
+
+/* Copy directory entries [from, to) from memory into their directory pages */
+static void hash_write_directory(Pager* pager, HashDirectory* directory, uint32_t from, uint32_t to) {
+    while (from < to) {
+        uint32_t page_index = from / HASH_DIRECTORY_PAGE_ENTRIES;
+        uint32_t page_num = directory->directory_pages[page_index];
+        uint32_t end = min(to, (page_index + 1) * HASH_DIRECTORY_PAGE_ENTRIES);
+        void* page = get_page(pager, page_num);
+        memcpy((uint32_t*)page + from % HASH_DIRECTORY_PAGE_ENTRIES, directory->buckets.data() + from,
+               (end - from) * sizeof(uint32_t));
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+        from = end;
+    }
+}
+
+/* Set up an empty hash table (one bucket) and return its meta page */
+uint32_t hash_create(Pager* pager) {
+    uint32_t meta_page_num = get_unused_page_num(pager);
+    void* meta = get_page(pager, meta_page_num);
+    set_node_type(meta, NODE_HASH_DIRECTORY);
+    set_node_root(meta, true);
+    pager_unpin(pager, meta_page_num);
+
+    HashDirectory directory;
+    directory.global_depth = 0;
+    directory.buckets.push_back(hash_new_bucket(pager, 0));
+    directory.directory_pages.push_back(get_unused_page_num(pager));
+    hash_write_directory(pager, &directory, 0, 1);
+    hash_write_meta(pager, meta_page_num, &directory);
+    return meta_page_num;
+}
+
+/* Read the directory of the hash table whose meta page is meta_page_num into memory */
+HashDirectory* hash_open(Pager* pager, uint32_t meta_page_num) {
+    void* meta = get_page(pager, meta_page_num);
+    if (get_node_type(meta) != NODE_HASH_DIRECTORY || *hash_meta_global_depth(meta) > HASH_MAX_GLOBAL_DEPTH) {
+        cout << "Hash table has no valid directory. Corrupt file." << endl;
+        exit(EXIT_FAILURE);
+    }
+    HashDirectory* directory = new HashDirectory();
+    directory->global_depth = *hash_meta_global_depth(meta);
+    directory->buckets.resize(1u << directory->global_depth);
+    uint32_t num_directory_pages = *hash_meta_num_directory_pages(meta);
+    for (uint32_t i = 0; i < num_directory_pages; i++) {
+        directory->directory_pages.push_back(*hash_meta_directory_page(meta, i));
+    }
+    pager_unpin(pager, meta_page_num);
+
+    for (uint32_t i = 0; i < num_directory_pages; i++) {
+        uint32_t page_num = directory->directory_pages[i];
+        uint32_t from = i * HASH_DIRECTORY_PAGE_ENTRIES;
+        uint32_t count = min((uint32_t)directory->buckets.size() - from, HASH_DIRECTORY_PAGE_ENTRIES);
+        void* page = get_page(pager, page_num);
+        memcpy(directory->buckets.data() + from, page, count * sizeof(uint32_t));
+        pager_unpin(pager, page_num);
+    }
+    return directory;
+}
+
+/* Point lookup; like table_lookup, safe next to the writer */
+bool hash_lookup(Table* table, uint32_t key, Row* row) {
+    Pager* pager = table->pager;
+    HashDirectory* directory = table->hash;
+    // 锁住桶之后才放开目录，这样桶不会在中间被分裂
+    shared_lock<shared_mutex> lock(directory->mutex);
+    uint32_t page_num = hash_bucket_page(directory, key);
+    void* bucket = get_page(pager, page_num);
+    pager_latch(pager, page_num, LATCH_SHARED);
+    lock.unlock();
+    uint32_t num_cells = *leaf_node_num_cells(bucket);
+    uint32_t cell_num = search_lower_bound(leaf_node_key(bucket, 0), num_cells, key);
+    bool found = cell_num < num_cells && *leaf_node_key(bucket, cell_num) == key;
+    if (found) {
+        row->id = key;
+        deserialize_row(leaf_node_value(bucket, cell_num), row);
+    }
+    pager_unlatch(pager, page_num, LATCH_SHARED);
+    pager_unpin(pager, page_num);
+    return found;
+}
+
+/*
+Split the full bucket page_num by the next bit of the hash, doubling
+the directory first if the bucket already uses every bit it has. The
+directory is held exclusively throughout, so no reader can look for a
+moved row in the old bucket.
+*/
+static void hash_split_bucket(Table* table, uint32_t page_num) {
+    Pager* pager = table->pager;
+    HashDirectory* directory = table->hash;
+    unique_lock<shared_mutex> lock(directory->mutex);
+    void* bucket = get_page(pager, page_num);
+    pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+    uint32_t local_depth = *hash_bucket_local_depth(bucket);
+    if (local_depth == directory->global_depth) {
+        // 新的一半和旧的一半指向同样的桶
+        uint32_t old_size = directory->buckets.size();
+        directory->buckets.resize(old_size * 2);
+        copy(directory->buckets.begin(), directory->buckets.begin() + old_size,
+             directory->buckets.begin() + old_size);
+        directory->global_depth += 1;
+        uint32_t needed = (old_size * 2 + HASH_DIRECTORY_PAGE_ENTRIES - 1) / HASH_DIRECTORY_PAGE_ENTRIES;
+        while (directory->directory_pages.size() < needed) {
+            directory->directory_pages.push_back(get_unused_page_num(pager));
+        }
+        hash_write_directory(pager, directory, old_size, old_size * 2);
+        hash_write_meta(pager, table->root_page_num, directory);
+    }
+
+    // 按第 local_depth 位把行分到两个桶，两边的 key 仍然有序
+    uint32_t new_page_num = hash_new_bucket(pager, local_depth + 1);
+    void* new_bucket = get_page(pager, new_page_num);
+    char copy[PAGE_SIZE];
+    memcpy(copy, bucket, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(copy);
+    *leaf_node_num_cells(bucket) = 0;
+    *leaf_node_heap_start(bucket) = PAGE_SIZE;
+    *hash_bucket_local_depth(bucket) = local_depth + 1;
+    uint32_t bit = 1u << local_depth;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint32_t key = *leaf_node_key(copy, i);
+        void* destination = (hash_id(key) & bit) ? new_bucket : bucket;
+        leaf_node_insert_cell(destination, *leaf_node_num_cells(destination), key,
+                              leaf_node_value(copy, i), leaf_node_value_size(copy, i));
+    }
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, new_page_num);
+    pager_unpin(pager, new_page_num);
+
+    for (uint32_t i = bit; i < directory->buckets.size(); i++) {
+        if ((i & bit) && directory->buckets[i] == page_num) {
+            directory->buckets[i] = new_page_num;
+            hash_write_directory(pager, directory, i, i + 1);
+        }
+    }
+    pager_unlatch(pager, page_num, LATCH_EXCLUSIVE);
+    pager_unpin(pager, page_num);
+}
+
+/* Writer only; the directory only changes under the writer, so reading it needs no lock */
+ExecuteResult hash_insert(Table* table, Row* row) {
+    Pager* pager = table->pager;
+    HashDirectory* directory = table->hash;
+    char record[ROW_MAX_SIZE];
+    uint32_t size = serialize_row(row, record);
+    uint32_t key = row->id;
+    while (true) {
+        uint32_t page_num = hash_bucket_page(directory, key);
+        void* bucket = get_page(pager, page_num);
+        pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+        uint32_t num_cells = *leaf_node_num_cells(bucket);
+        uint32_t cell_num = search_lower_bound(leaf_node_key(bucket, 0), num_cells, key);
+        ExecuteResult result = EXECUTE_SUCCESS;
+        bool done = true;
+        if (cell_num < num_cells && *leaf_node_key(bucket, cell_num) == key) {
+            result = EXECUTE_DUPLICATE_KEY;
+        } else if (leaf_node_insert_cell(bucket, cell_num, key, record, size)) {
+            pager_mark_dirty(pager, page_num);
+        } else if (*hash_bucket_local_depth(bucket) == HASH_MAX_GLOBAL_DEPTH) {
+            result = EXECUTE_TABLE_FULL;
+        } else {
+            done = false;
+        }
+        pager_unlatch(pager, page_num, LATCH_EXCLUSIVE);
+        pager_unpin(pager, page_num);
+        if (done) {
+            return result;
+        }
+        // 分裂之后所有行可能仍在同一边，所以重新找桶再试
+        hash_split_bucket(table, page_num);
+    }
+}
+
+/*
+Replace the row with row->id in its bucket, returning the old one in
+*old_row; writer only. A bucket too full for a longer row is split
+with the old row still in it, so readers never miss the row.
+*/
+ExecuteResult hash_update(Table* table, Row* row, Row* old_row) {
+    Pager* pager = table->pager;
+    char record[ROW_MAX_SIZE];
+    uint32_t size = serialize_row(row, record);
+    uint32_t key = row->id;
+    while (true) {
+        uint32_t page_num = hash_bucket_page(table->hash, key);
+        void* bucket = get_page(pager, page_num);
+        pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+        uint32_t num_cells = *leaf_node_num_cells(bucket);
+        uint32_t cell_num = search_lower_bound(leaf_node_key(bucket, 0), num_cells, key);
+        ExecuteResult result = EXECUTE_SUCCESS;
+        bool done = true;
+        if (cell_num >= num_cells || *leaf_node_key(bucket, cell_num) != key) {
+            result = EXECUTE_KEY_NOT_FOUND;
+        } else {
+            old_row->id = key;
+            deserialize_row(leaf_node_value(bucket, cell_num), old_row);
+            if (leaf_node_update_cell(bucket, cell_num, record, size)) {
+                pager_mark_dirty(pager, page_num);
+            } else if (*hash_bucket_local_depth(bucket) == HASH_MAX_GLOBAL_DEPTH) {
+                result = EXECUTE_TABLE_FULL;
+            } else {
+                done = false;
+            }
+        }
+        pager_unlatch(pager, page_num, LATCH_EXCLUSIVE);
+        pager_unpin(pager, page_num);
+        if (done) {
+            return result;
+        }
+        hash_split_bucket(table, page_num);
+    }
+}
+
+/* Remove key, returning its row; writer only */
+bool hash_delete(Table* table, uint32_t key, Row* row) {
+    Pager* pager = table->pager;
+    uint32_t page_num = hash_bucket_page(table->hash, key);
+    void* bucket = get_page(pager, page_num);
+    pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+    uint32_t num_cells = *leaf_node_num_cells(bucket);
+    uint32_t cell_num = search_lower_bound(leaf_node_key(bucket, 0), num_cells, key);
+    bool found = cell_num < num_cells && *leaf_node_key(bucket, cell_num) == key;
+    if (found) {
+        row->id = key;
+        deserialize_row(leaf_node_value(bucket, cell_num), row);
+        leaf_node_remove_cell(bucket, cell_num);
+        pager_mark_dirty(pager, page_num);
+    }
+    pager_unlatch(pager, page_num, LATCH_EXCLUSIVE);
+    pager_unpin(pager, page_num);
+    return found;
+}
+
+/*
+Append the rows with start <= id <= end to *rows, in id order. Rows
+are not kept in id order across buckets, so every bucket is read; the
+directory is held shared meanwhile so that no row can move into a
+bucket that was already read.
+*/
+void hash_collect(Table* table, uint32_t start, uint32_t end, vector<Row>* rows) {
+    Pager* pager = table->pager;
+    HashDirectory* directory = table->hash;
+    size_t first = rows->size();
+    shared_lock<shared_mutex> lock(directory->mutex);
+    vector<uint32_t> page_nums(directory->buckets);
+    sort(page_nums.begin(), page_nums.end());
+    page_nums.erase(unique(page_nums.begin(), page_nums.end()), page_nums.end());
+    Row row;
+    for (uint32_t page_num : page_nums) {
+        void* bucket = get_page(pager, page_num);
+        pager_latch(pager, page_num, LATCH_SHARED);
+        uint32_t num_cells = *leaf_node_num_cells(bucket);
+        for (uint32_t i = search_lower_bound(leaf_node_key(bucket, 0), num_cells, start); i < num_cells; i++) {
+            row.id = *leaf_node_key(bucket, i);
+            if (row.id > end) {
+                break;
+            }
+            deserialize_row(leaf_node_value(bucket, i), &row);
+            rows->push_back(row);
+        }
+        pager_unlatch(pager, page_num, LATCH_SHARED);
+        pager_unpin(pager, page_num);
+    }
+    lock.unlock();
+    sort(rows->begin() + first, rows->end(), [](const Row& a, const Row& b) { return a.id < b.id; });
+}
+
+void print_hash_table(Table* table) {
+    HashDirectory* directory = table->hash;
+    shared_lock<shared_mutex> lock(directory->mutex);
+    vector<uint32_t> page_nums(directory->buckets);
+    sort(page_nums.begin(), page_nums.end());
+    page_nums.erase(unique(page_nums.begin(), page_nums.end()), page_nums.end());
+    uint64_t num_rows = 0;
+    for (uint32_t page_num : page_nums) {
+        void* bucket = get_page(table->pager, page_num);
+        pager_latch(table->pager, page_num, LATCH_SHARED);
+        num_rows += *leaf_node_num_cells(bucket);
+        pager_unlatch(table->pager, page_num, LATCH_SHARED);
+        pager_unpin(table->pager, page_num);
+    }
+    cout << "- global depth " << directory->global_depth << ", " << page_nums.size()
+         << " buckets, " << num_rows << " rows\n";
+}
@@ -0,0 +1,272 @@
+#include "mydb.h"
+#include <iomanip>
+
+using namespace std;
+
+#define BATCH_READ_SIZE (1024 * 1024)   // --batch 每次从 stdin 读这么多
+
+/*
+Hands out stdin one line at a time for --batch, reading it in
+BATCH_READ_SIZE chunks. A line points into the buffer and stays valid
+until the next call.
+*/
+typedef struct {
+    vector<char> buffer;
+    size_t start;       // 下一行的开头
+    size_t end;         // 已读入的数据的末尾
+    bool eof;
+} LineReader;
+
+static void line_reader_init(LineReader* reader) {
+    reader->buffer.resize(BATCH_READ_SIZE);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = false;
+}
+
+static bool line_reader_next(LineReader* reader, string_view* line) {
+    while (true) {
+        char* data = reader->buffer.data();
+        char* newline = (char*)memchr(data + reader->start, '\n', reader->end - reader->start);
+        if (newline != NULL) {
+            *line = string_view(data + reader->start, newline - (data + reader->start));
+            reader->start = newline - data + 1;
+            return true;
+        }
+        if (reader->eof) {
+            // 最后一行可以没有换行符
+            *line = string_view(data + reader->start, reader->end - reader->start);
+            reader->start = reader->end;
+            return !line->empty();
+        }
+        // 把没读完的半行挪到开头，一整块都放不下一行时把缓冲区加倍
+        memmove(data, data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        if (reader->end == reader->buffer.size()) {
+            reader->buffer.resize(reader->buffer.size() * 2);
+            data = reader->buffer.data();
+        }
+        ssize_t n = read(STDIN_FILENO, data + reader->end, reader->buffer.size() - reader->end);
+        if (n < 0) {
+            cout << "Error reading stdin: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        reader->eof = n == 0;
+        reader->end += n;
+    }
+}
+
+/* Report a statement that could not be prepared; syntax errors were already reported */
+static bool check_prepare_result(PrepareResult result, string_view input) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            return true;
+        case (PREPARE_SYNTAX_ERROR):
+            break;
+        case (PREPARE_STRING_TOO_LONG):
+            cout << "String is too long." << endl;
+            break;
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            cout << "Unrecognized keyword at start of '" << input << "'." << endl;
+            break;
+    }
+    return false;
+}
+
+/* execute <name> <value> ...: bind the values in order and run the statement */
+static bool bind_arguments(PreparedStatement* prepared, const vector<string>& arguments) {
+    if (arguments.size() != prepared->params.size()) {
+        cout << "Error: Expected " << prepared->params.size() << " parameters." << endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < arguments.size(); i++) {
+        PrepareResult result = prepared_bind_text(prepared, i, arguments[i]);
+        if (result == PREPARE_SYNTAX_ERROR) {
+            cout << "Error: Parameter " << i + 1 << " must be a number." << endl;
+            return false;
+        }
+        if (!check_prepare_result(result, arguments[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Prepare and run one statement, reporting any error. quiet drops the
+"Executed." and "Prepared." acknowledgements for --batch. Returns
+whether the statement succeeded.
+*/
+static bool run_statement(string_view input, Table* table, ResultSink* sink,
+                          unordered_map<string, PreparedStatement>* prepared_statements, bool quiet) {
+    Statement statement;
+    if (!check_prepare_result(prepare_statement(input, &statement), input)) {
+        return false;
+    }
+    ExecuteResult result;
+    if (statement.type == STATEMENT_PREPARE) {
+        PreparedStatement prepared;
+        if (!check_prepare_result(prepared_init(statement.text, &prepared), statement.text)) {
+            return false;
+        }
+        (*prepared_statements)[statement.name] = move(prepared);
+        if (!quiet) {
+            cout << "Prepared." << endl;
+        }
+        return true;
+    } else if (statement.type == STATEMENT_EXECUTE) {
+        auto it = prepared_statements->find(statement.name);
+        if (it == prepared_statements->end()) {
+            cout << "Error: No prepared statement named '" << statement.name << "'." << endl;
+            return false;
+        }
+        if (!bind_arguments(&it->second, statement.arguments)) {
+            return false;
+        }
+        result = prepared_execute(&it->second, table, sink);
+    } else {
+        result = execute_statement(&statement, table, sink);
+    }
+    switch (result) {
+        case (EXECUTE_SUCCESS):
+            if (!quiet) {
+                cout << "Executed." << endl;
+            }
+            return true;
+        case (EXECUTE_DUPLICATE_KEY):
+            cout << "Error: Duplicate key." << endl;
+            break;
+        case (EXECUTE_TABLE_FULL):
+            cout << "Error: Table full." << endl;
+            break;
+        case (EXECUTE_KEY_NOT_FOUND):
+            cout << "Error: Key not found." << endl;
+            break;
+        case (EXECUTE_INDEX_EXISTS):
+            cout << "Error: Index already exists." << endl;
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    char* filename = NULL;
+    ResultFormat output_format = RESULT_FORMAT_TEXT;
+    bool batch = false;
+    DbOptions options;
+    db_options_init(&options);
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--cache-pages" && i + 1 < argc) {
+            options.num_frames = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--mmap") {
+            options.mode = PAGER_MMAP;
+        } else if (arg == "--no-wal") {
+            options.use_wal = false;
+        } else if (arg == "--wal-sync" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode != "full" && mode != "normal") {
+                cout << "--wal-sync must be full or normal." << endl;
+                exit(EXIT_FAILURE);
+            }
+            options.wal_sync = (mode == "full") ? WAL_SYNC_FULL : WAL_SYNC_NORMAL;
+        } else if (arg == "--group-commit-ms" && i + 1 < argc) {
+            options.group_commit_ms = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--readahead" && i + 1 < argc) {
+            options.readahead_pages = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--no-uring") {
+            options.use_uring = false;
+        } else if (arg == "--internal-node-max-cells" && i + 1 < argc) {
+            options.internal_node_max_cells = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--hash") {
+            options.organization = TABLE_HASH;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--output" && i + 1 < argc) {
+            string format = argv[++i];
+            if (format == "text") {
+                output_format = RESULT_FORMAT_TEXT;
+            } else if (format == "tsv") {
+                output_format = RESULT_FORMAT_TSV;
+            } else if (format == "binary") {
+                output_format = RESULT_FORMAT_BINARY;
+            } else {
+                cout << "Unrecognized output format '" << format << "'." << endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if (filename == NULL) {
+            filename = argv[i];
+        } else {
+            cout << "Unrecognized argument '" << arg << "'." << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (filename == NULL) {
+        cout << "Must supply a database filename." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (batch) {
+        // 批处理模式不和 C stdio 混用，cout 自己缓冲
+        ios::sync_with_stdio(false);
+    }
+
+    Table* table = db_open(filename, &options);
+    ResultSink sink;    // select 的结果先攒在这里，整块写出
+    result_sink_init(&sink, &cout, output_format);
+    string input_buffer;
+    unordered_map<string, PreparedStatement> prepared_statements;   // prepare 过的语句，按名字找
+    LineReader reader;
+    if (batch) {
+        line_reader_init(&reader);
+    }
+    uint64_t num_statements = 0;
+    uint64_t num_failed = 0;
+    auto start = chrono::steady_clock::now();
+
+    // 读到 .exit 或输入结束为止
+    while (true) {
+        string_view line;
+        if (batch) {
+            if (!line_reader_next(&reader, &line)) {
+                break;
+            }
+            if (line.find_first_not_of(" \t\r") == string_view::npos) {
+                continue;
+            }
+        } else {
+            print_prompt();
+            if (!getline(cin, input_buffer)) {
+                break;
+            }
+            line = input_buffer;
+        }
+        if (line == ".exit") {
+            break;
+        }
+        if (!line.empty() && line[0] == '.') {
+            string command(line);
+            if (do_meta_command(command, table) == META_COMMAND_UNRECOGNIZED_COMMAND) {
+                cout << "Unrecognized command '" << command << "'." << endl;
+            }
+            continue;
+        }
+        num_statements++;
+        if (!run_statement(line, table, &sink, &prepared_statements, batch)) {
+            num_failed++;
+        }
+    }
+
+    if (batch) {
+        // 统计写到 stderr，stdout 上只有查询结果
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << "Executed " << num_statements << " statements (" << num_failed << " failed) in "
+             << fixed << setprecision(3) << seconds << " s, " << setprecision(0)
+             << (seconds > 0 ? num_statements / seconds : 0.0) << " statements/s." << endl;
+    }
+    db_close(table);
+    return EXIT_SUCCESS;
+}
@@ -64,113 +64,35 @@ vector<string> splitAndRemoveEmptyString(const string& str, char delimiter) {
     return result;
 }
 
-PrepareResult prepare_statement(string input_buffer, Statement* statement) {
-    input_buffer = trim(input_buffer);
-
-    if (input_buffer.substr(0, 6) == "insert") {
-        statement->type = STATEMENT_INSERT;
-        istringstream iss(input_buffer);
-        string command;
-        string username;
-        string email;
-
-        if (!(iss >> command >> statement->row_to_insert.id >> username >> email)) {
-            cout << "Syntax error. Could not parse statement." << endl;
-            return PREPARE_SYNTAX_ERROR;
-        }
-
-        if (command != "insert") {
-            cout << "Syntax error. Could not parse statement." << endl;
-            return PREPARE_SYNTAX_ERROR;
-        }
-
-        if (username.length() > COLUMN_USERNAME_SIZE || email.length() > COLUMN_EMAIL_SIZE) {
-            return PREPARE_STRING_TOO_LONG;
-        }
-
-        strncpy(statement->row_to_insert.username, username.c_str(), COLUMN_USERNAME_SIZE);
-        statement->row_to_insert.username[username.length()] = '\0';
-        strncpy(statement->row_to_insert.email, email.c_str(), COLUMN_EMAIL_SIZE);
-        statement->row_to_insert.email[email.length()] = '\0';
-
-        return PREPARE_SUCCESS;
-    }
-    if (input_buffer.substr(0, 6) == "create") {
-        statement->type = STATEMENT_CREATE;
-
-        string tableName;
-        vector<string> colNames;
-        vector<Type> colTypes;
-
-        regex pattern(R"(create\s+table\s+(\w+)\s*\((.*)\))");
-        
-        smatch matches;
-        if (regex_search(input_buffer, matches, pattern)) {
-            tableName = matches[1];
-            string columnsStr = matches[2];
-            vector<string> cols_ = split(columnsStr, ',');
-            vector<string> cols;
-            for (int i=0;i<cols_.size();i++) {
-                // ,分割后为空
-                if (trim(cols_[i]).length() == 0) {
-                    cout << "syntax error, create table tableName(col1 type1, col2 type2...);\n";
-                    return PREPARE_SYNTAX_ERROR;
-                } else {
-                    cols.push_back(trim(cols_[i]));
-                }
-            }
-            // cout << "cols:\n";
-            vector<string> tmp_;
-            for (int i=0;i<cols.size();i++) {
-                tmp_ = splitAndRemoveEmptyString(cols[i], ' ');
-                if (tmp_.size() != 2) {
-                    cout << "syntax error, create table tableName(col1 type1, col2 type2...);\n";
-                    return PREPARE_SYNTAX_ERROR;
-                } else {
-                    if (tmp_[1] != "INT" && tmp_[1] != "STRING") {
-                        cout << "syntax error, unsupported type '" << tmp_[1] << "'\n";
-                        return PREPARE_SYNTAX_ERROR;
-                    } else {
-                        // cout << "colName: " << tmp_[0] << "\n";
-                        // cout << "colType: " << tmp_[1] << "\n";
-                        colNames.push_back(tmp_[0]);
-                        if (tmp_[1] == "INT") {
-                            colTypes.push_back(INT);
-                        } else if (tmp_[1] == "STRING") {
-                            colTypes.push_back(STRING);
-                        }
-                    }
-                }
-            }
-            // cout << endl;
-        } else {
-            cout << "syntax error, create table tableName(col1 type1, col2 type2...);\n";
-            return PREPARE_SYNTAX_ERROR;
-        }
-        statement->table_to_create.colNames = colNames;
-        statement->table_to_create.colTypes = colTypes;
-
-        return PREPARE_SUCCESS;
+/* A select writes its rows to sink; other statements may pass NULL */
+ExecuteResult execute_statement(Statement* statement, Table* table, ResultSink* sink) {
+    if (statement->type == STATEMENT_SELECT) {
+        // 读语句不改任何页，靠 page latch 和写语句并发
+        return execute_select(statement, table, sink);
     }
-    if (input_buffer == "select") {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
-    }
-    return PREPARE_UNRECOGNIZED_STATEMENT;
-}
-
-ExecuteResult execute_statement(Statement* statement, Table* table) {
+    // 写语句连同提交一次只执行一条
+    lock_guard<mutex> writer_lock(table->writer_mutex);
+    ExecuteResult result;
     switch (statement->type) {
         case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
-        case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+            result = execute_insert(statement, table);
+            break;
+        case (STATEMENT_DELETE):
+            result = execute_delete(statement, table);
+            break;
         case (STATEMENT_CREATE):
-            return execute_create(statement, table);
+            result = execute_create(statement, table);
+            break;
+        case (STATEMENT_CREATE_INDEX):
+            result = execute_create_index(statement, table);
+            break;
         default:
             // 不应该到达这里
             return EXECUTE_UNKNOWN_COMMAND;
     }
+    // 每条语句是一个事务
+    pager_commit(table->pager);
+    return result;
 }
 
 MetaCommandResult do_meta_command(string input_buffer, Table* table) {
@@ -178,10 +100,69 @@ MetaCommandResult do_meta_command(string input_buffer, Table* table) {
         db_close(table);
         exit(EXIT_SUCCESS);
     } else if (input_buffer == ".btree") {
+        if (table->organization == TABLE_HASH) {
+            cout << "Hash table:\n";
+            print_hash_table(table);
+            return META_COMMAND_SUCCESS;
+        }
         cout << "Tree:\n";
-        print_tree(table->pager, 0, 0);
+        print_tree(table->pager, table->root_page_num, 0);
         // print_page(table->pager, 0);
         return META_COMMAND_SUCCESS;
+    } else if (input_buffer == ".flush") {
+        lock_guard<mutex> writer_lock(table->writer_mutex);
+        pager_flush_all(table->pager);
+        return META_COMMAND_SUCCESS;
+    } else if (input_buffer.substr(0, 6) == ".load ") {
+        istringstream iss(input_buffer.substr(6));
+        string path;
+        string fill_text;
+        string rest;
+        long fill_percent = BULK_LOAD_DEFAULT_FILL_PERCENT;
+        bool valid = (bool)(iss >> path);
+        if (valid && iss >> fill_text) {
+            // 按有符号数解析，-5 之类的不会绕成很大的数
+            char* fill_end;
+            errno = 0;
+            fill_percent = strtol(fill_text.c_str(), &fill_end, 10);
+            valid = *fill_end == '\0' && errno == 0 && fill_percent >= 1 && fill_percent <= 100;
+        }
+        if (!valid || iss >> rest) {
+            cout << "Usage: .load <file> [fill_percent]" << endl;
+            return META_COMMAND_SUCCESS;
+        }
+        uint64_t num_rows = 0;
+        switch (bulk_load_file(table, path.c_str(), fill_percent, &num_rows)) {
+            case (EXECUTE_SUCCESS):
+                cout << "Loaded " << num_rows << " rows." << endl;
+                break;
+            case (EXECUTE_DUPLICATE_KEY):
+                cout << "Error: Duplicate key on line " << num_rows << "." << endl;
+                break;
+            case (EXECUTE_UNSORTED_KEY):
+                cout << "Error: Keys must be sorted, line " << num_rows << " is out of order." << endl;
+                break;
+            default:
+                break;
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (input_buffer == ".truncate") {
+        lock_guard<mutex> writer_lock(table->writer_mutex);
+        uint32_t released = pager_truncate_free_pages(table->pager);
+        cout << "Released " << released << " pages.\n";
+        return META_COMMAND_SUCCESS;
+    } else if (input_buffer == ".checkpoint") {
+        lock_guard<mutex> writer_lock(table->writer_mutex);
+        pager_checkpoint(table->pager);
+        return META_COMMAND_SUCCESS;
+    } else if (input_buffer == ".stats") {
+        print_pager_stats(table->pager);
+        print_freelist_stats(table->pager);
+        print_scan_stats(table);
+        if (table->pager->wal) {
+            print_wal_stats(table->pager->wal);
+        }
+        return META_COMMAND_SUCCESS;
     } else if (input_buffer == ".constants") {
         cout << "Constants:\n";
         print_constants();
@@ -192,162 +173,1186 @@ MetaCommandResult do_meta_command(string input_buffer, Table* table) {
 }
 
 
-void serialize_row(Row* source, void* destination) {
-    char* dest = static_cast<char*>(destination);
+uint32_t row_encoded_size(Row* row) {
+    return ROW_LENGTHS_SIZE + strnlen(row->username, COLUMN_USERNAME_SIZE) + strnlen(row->email, COLUMN_EMAIL_SIZE);
+}
+
+/* Encode the row's strings (see ROW_MAX_SIZE) and return the bytes written */
+uint32_t serialize_row(Row* source, void* destination) {
+    uint8_t* dest = static_cast<uint8_t*>(destination);
+    uint8_t username_length = strnlen(source->username, COLUMN_USERNAME_SIZE);
+    uint8_t email_length = strnlen(source->email, COLUMN_EMAIL_SIZE);
+
+    dest[0] = username_length;
+    dest[1] = email_length;
+    memcpy(dest + ROW_LENGTHS_SIZE, source->username, username_length);
+    memcpy(dest + ROW_LENGTHS_SIZE + username_length, source->email, email_length);
+    return ROW_LENGTHS_SIZE + username_length + email_length;
+}
 
-    memcpy(dest + ID_OFFSET, &(source->id), ID_SIZE);
-    strncpy(dest + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    strncpy(dest + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+/* Decode the row's strings and return the bytes read; the id is the cell's key */
+uint32_t deserialize_row(void* source, Row* destination) {
+    uint8_t* src = static_cast<uint8_t*>(source);
+    uint8_t username_length = src[0];
+    uint8_t email_length = src[1];
+
+    memcpy(destination->username, src + ROW_LENGTHS_SIZE, username_length);
+    destination->username[username_length] = '\0';
+    memcpy(destination->email, src + ROW_LENGTHS_SIZE + username_length, email_length);
+    destination->email[email_length] = '\0';
+    return ROW_LENGTHS_SIZE + username_length + email_length;
 }
 
-void deserialize_row(void* source, Row* destination) {
-    char* src = static_cast<char*>(source);
 
-    memcpy(&(destination->id), src + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), src + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), src + EMAIL_OFFSET, EMAIL_SIZE);
+/*
+Extend the db file and map the new tail right after the current
+mapping, in steps of PAGER_MMAP_GROW_PAGES.
+*/
+static void pager_mmap_grow(Pager* pager, off_t min_length) {
+    off_t step = (off_t)PAGER_MMAP_GROW_PAGES * PAGE_SIZE;
+    off_t new_length = (min_length + step - 1) / step * step;
+    if ((uint64_t)new_length > PAGER_MMAP_RESERVE_BYTES) {
+        cout << "Db file exceeds the mmap reservation." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+        cout << "Error growing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    void* tail = mmap(pager->map + pager->map_length, new_length - pager->map_length,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                      pager->file_descriptor, pager->map_length);
+    if (tail == MAP_FAILED) {
+        cout << "Error mapping db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->map_length = new_length;
+    pager->file_length = new_length;
+    while (pager->map_latches.size() < (size_t)(new_length / step)) {
+        pager->map_latches.emplace_back(new shared_mutex[PAGER_MMAP_GROW_PAGES]);
+    }
 }
 
+/*
+A read or write issued through pager->io has finished. A read
+covers a chain of frames linked by io_next; each drops the pin that
+kept it from being evicted while in flight.
+*/
+static void pager_complete_io(Pager* pager, PageIoCompletion* completion) {
+    if (completion->user_data & PAGER_IO_WRITE_TAG) {
+        uint32_t num_pages = (uint32_t)(completion->user_data & ~PAGER_IO_WRITE_TAG);
+        if (completion->result != (int32_t)(num_pages * PAGE_SIZE)) {
+            cout << "Error writing: " << completion->result << endl;
+            exit(EXIT_FAILURE);
+        }
+        pager->pending_writes -= 1;
+        return;
+    }
+    uint32_t num_pages = 0;
+    for (uint32_t i = completion->user_data; i != INVALID_PAGE_NUM; i = pager->frames[i].io_next) {
+        num_pages++;
+    }
+    if (completion->result != (int32_t)(num_pages * PAGE_SIZE)) {
+        cout << "Error reading file: " << completion->result << endl;
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = completion->user_data; i != INVALID_PAGE_NUM; i = pager->frames[i].io_next) {
+        pager->frames[i].io_pending = false;
+        pager->frames[i].pin_count -= 1;
+    }
+    pager->pending_reads -= num_pages;
+}
 
-void* get_page(Pager* pager, uint32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        cout << "Tried to fetch page number out of bounds. " << page_num
-             << " > " << TABLE_MAX_PAGES << endl;
+static void pager_reap_io(Pager* pager, bool wait) {
+    PageIoCompletion completion;
+    while (page_io_reap(pager->io, &completion, wait)) {
+        pager_complete_io(pager, &completion);
+        if (wait) {
+            return;
+        }
+    }
+    if (wait) {
+        cout << "Waited for page I/O but none was outstanding." << endl;
         exit(EXIT_FAILURE);
     }
-    if (pager->pages[page_num] == NULL) {
-        // Cache miss. Allocate memory and load from file.
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-        // We might save a partial page at the end of the file
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
-        if (page_num <= num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                cout << "Error reading file: " << errno << endl;
-                exit(EXIT_FAILURE);
+}
+
+/*
+Wait until the I/O on frame finishes. A read through pager->io is
+reaped right here; one that get_page does without the lock is waited
+for on io_done, which lets go of the lock, so the caller has to look
+its page up again afterwards.
+*/
+static void pager_wait_frame(Pager* pager, Frame* frame, unique_lock<shared_mutex>& lock) {
+    while (frame->io_pending) {
+        if (frame->io_sync) {
+            pager->io_done.wait(lock);
+        } else {
+            pager_reap_io(pager, true);
+        }
+    }
+}
+
+static void pager_write_page(Pager* pager, const void* data, uint32_t page_num) {
+    ssize_t bytes_written = pwrite(pager->file_descriptor, data, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+    if (bytes_written == -1) {
+        cout << "Error writing: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Block until every read and write issued through pager->io has completed */
+void pager_wait_io(Pager* pager) {
+    if (pager->io == NULL) {
+        return;
+    }
+    unique_lock<shared_mutex> lock(pager->mutex);
+    while (pager->pending_reads + pager->pending_writes > 0) {
+        pager_reap_io(pager, true);
+    }
+}
+
+static uint32_t pager_prefetch_budget(Pager* pager) {
+    uint32_t limit = pager->num_frames / PAGER_PREFETCH_POOL_FRACTION;
+    return pager->pending_reads < limit ? limit - pager->pending_reads : 0;
+}
+
+static bool pager_can_prefetch(Pager* pager, uint32_t page_num) {
+    return page_num < pager->file_length / PAGE_SIZE && pager->page_table.count(page_num) == 0;
+}
+
+/*
+Start reading pages into the pool without waiting for them. Runs of
+consecutive page numbers become one vectored read each and the whole
+batch goes out in a single submission. Pages already cached or not
+yet in the file are skipped, and reads in flight never hold more than
+1/PAGER_PREFETCH_POOL_FRACTION of the pool. get_page waits on a frame
+whose read has not finished. Prefetching stops at a dirty victim, whose
+write-back is left to get_page outside the lock. Returns the number of
+pages requested.
+*/
+static uint32_t pager_prefetch_locked(Pager* pager, const uint32_t* page_nums, uint32_t count) {
+    if (pager->io == NULL) {
+        return 0;
+    }
+    pager_reap_io(pager, false);
+    vector<struct iovec> iov(count);
+    uint32_t num_iov = 0;
+    uint32_t started = 0;
+    uint32_t i = 0;
+    bool dirty_victim = false;
+    while (i < count && !dirty_victim) {
+        if (!pager_can_prefetch(pager, page_nums[i])) {
+            i++;
+            continue;
+        }
+        if (pager_prefetch_budget(pager) == 0 || page_io_free_slots(pager->io) == 0) {
+            break;
+        }
+        uint32_t first_page_num = page_nums[i];
+        uint32_t head = INVALID_PAGE_NUM;
+        Frame* prev = NULL;
+        uint32_t run_length = 0;
+        uint32_t run_iov = num_iov;
+        while (i < count && page_nums[i] == first_page_num + run_length &&
+               run_length < PAGER_PREFETCH_MAX_RUN && pager_prefetch_budget(pager) > 0 &&
+               pager_can_prefetch(pager, page_nums[i])) {
+            uint32_t frame_index = pager_find_victim(pager);
+            Frame* frame = &pager->frames[frame_index];
+            if (frame->dirty) {
+                dirty_victim = true;
+                break;
+            }
+            if (frame->page_num != INVALID_PAGE_NUM) {
+                pager->page_table.erase(frame->page_num);
+                pager->stats.evictions += 1;
+            }
+            frame->page_num = page_nums[i];
+            frame->pin_count = 1;       // 由读请求持有，完成时释放
+            frame->referenced = true;
+            frame->dirty = false;
+            frame->in_txn = false;
+            frame->io_pending = true;
+            frame->io_next = INVALID_PAGE_NUM;
+            if (prev) {
+                prev->io_next = frame_index;
+            } else {
+                head = frame_index;
+            }
+            prev = frame;
+            pager->page_table[frame->page_num] = frame_index;
+            iov[num_iov].iov_base = frame->data;
+            iov[num_iov].iov_len = PAGE_SIZE;
+            num_iov++;
+            pager->pending_reads += 1;
+            run_length++;
+            i++;
+        }
+        if (run_length > 0) {
+            page_io_queue(pager->io, PAGE_IO_READ, pager->file_descriptor, &iov[run_iov], run_length,
+                          (off_t)first_page_num * PAGE_SIZE, head);
+        }
+        started += run_length;
+    }
+    page_io_submit(pager->io);
+    return started;
+}
+
+uint32_t pager_prefetch(Pager* pager, const uint32_t* page_nums, uint32_t count) {
+    unique_lock<shared_mutex> lock(pager->mutex);
+    return pager_prefetch_locked(pager, page_nums, count);
+}
+
+/*
+Return the page pinned in the buffer pool. Every call must be
+balanced by a pager_unpin once the caller no longer touches the page.
+A hit on a page that is not being read in only takes the pager's lock
+shared; everything else takes it exclusively, but never across I/O.
+*/
+void* get_page(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        off_t page_end = ((off_t)page_num + 1) * PAGE_SIZE;
+        {
+            shared_lock<shared_mutex> lock(pager->mutex);
+            if (page_end <= pager->map_length && page_num < pager->num_pages) {
+                pager->stats.hits += 1;
+                return pager->map + (off_t)page_num * PAGE_SIZE;
             }
         }
-        pager->pages[page_num] = page;
+        unique_lock<shared_mutex> lock(pager->mutex);
+        if (page_end > pager->map_length) {
+            pager_mmap_grow(pager, page_end);
+        }
+        pager->stats.hits += 1;
         if (page_num >= pager->num_pages) {
             pager->num_pages = page_num + 1;
         }
+        return pager->map + (off_t)page_num * PAGE_SIZE;
+    }
+
+    {
+        shared_lock<shared_mutex> lock(pager->mutex);
+        auto it = pager->page_table.find(page_num);
+        if (it != pager->page_table.end() && !pager->frames[it->second].io_pending) {
+            Frame* frame = &pager->frames[it->second];
+            frame->pin_count += 1;
+            // 先读再写，热点页（比如根）的缓存行不会被每次访问弄脏
+            if (!frame->referenced) {
+                frame->referenced = true;
+            }
+            pager->stats.hits += 1;
+            return frame->data;
+        }
+    }
+
+    unique_lock<shared_mutex> lock(pager->mutex);
+    while (true) {
+        auto it = pager->page_table.find(page_num);
+        if (it == pager->page_table.end()) {
+            break;
+        }
+        Frame* frame = &pager->frames[it->second];
+        if (frame->io_pending) {
+            // 等待期间帧可能换了页，醒来后重新查
+            pager_wait_frame(pager, frame, lock);
+            continue;
+        }
+        frame->pin_count += 1;
+        frame->referenced = true;
+        pager->stats.hits += 1;
+        return frame->data;
+    }
+
+    /*
+    Cache miss. Claim a frame and mark it io_pending, then let go of the
+    lock to write back the page it held (after the WAL covering it is
+    synced) and to read the new one. Both pages stay in the page table
+    until then, so nobody reads the old one from the file too early or
+    loads the new one twice.
+    */
+    pager->stats.misses += 1;
+    uint32_t frame_index = pager_find_victim(pager);
+    Frame* frame = &pager->frames[frame_index];
+    uint32_t victim_page_num = frame->page_num;
+    bool write_back = victim_page_num != INVALID_PAGE_NUM && frame->dirty;
+    if (victim_page_num != INVALID_PAGE_NUM) {
+        pager->stats.evictions += 1;
+        if (!write_back) {
+            pager->page_table.erase(victim_page_num);
+        }
+    }
+    bool in_file = page_num < pager->file_length / PAGE_SIZE;
+    frame->page_num = page_num;
+    frame->pin_count = 1;
+    frame->referenced = true;
+    frame->dirty = false;
+    frame->in_txn = false;
+    frame->io_pending = true;
+    frame->io_sync = true;
+    pager->page_table[page_num] = frame_index;
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    if (write_back) {
+        pager->sync_write_backs += 1;
     }
-    return pager->pages[page_num];
+    lock.unlock();
+
+    if (write_back) {
+        if (pager->wal) {
+            wal_sync(pager->wal);
+        }
+        pager_write_page(pager, frame->data, victim_page_num);
+    }
+    if (in_file) {
+        ssize_t bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE,
+                                   (off_t)page_num * PAGE_SIZE);
+        if (bytes_read == -1) {
+            cout << "Error reading file: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // 文件中还不存在的新页
+        memset(frame->data, 0, PAGE_SIZE);
+    }
+
+    lock.lock();
+    if (write_back) {
+        pager->page_table.erase(victim_page_num);
+        pager->sync_write_backs -= 1;
+        pager->stats.write_backs += 1;
+        pager->stats.pages_written += 1;
+        pager->stats.write_calls += 1;
+        off_t victim_end = ((off_t)victim_page_num + 1) * PAGE_SIZE;
+        if (victim_end > pager->file_length) {
+            pager->file_length = victim_end;
+        }
+    }
+    frame->io_pending = false;
+    frame->io_sync = false;
+    pager->io_done.notify_all();
+    return frame->data;
 }
 
-void* cursor_value(Cursor* cursor) {
+void pager_unpin(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        return;
+    }
+    shared_lock<shared_mutex> lock(pager->mutex);
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end() || pager->frames[it->second].pin_count == 0) {
+        cout << "Tried to unpin page " << page_num << " which is not pinned" << endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[it->second].pin_count -= 1;
+}
+
+/*
+The latch of a pinned page. Finding it only takes the pager's lock
+shared, and waiting for the latch happens after that is released.
+*/
+static shared_mutex* pager_page_latch(Pager* pager, uint32_t page_num) {
+    shared_lock<shared_mutex> lock(pager->mutex);
+    if (pager->mode == PAGER_MMAP) {
+        return &pager->map_latches[page_num / PAGER_MMAP_GROW_PAGES][page_num % PAGER_MMAP_GROW_PAGES];
+    }
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end() || pager->frames[it->second].pin_count == 0) {
+        cout << "Tried to latch page " << page_num << " which is not pinned" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return &pager->frames[it->second].latch;
+}
+
+void pager_latch(Pager* pager, uint32_t page_num, LatchMode mode) {
+    shared_mutex* latch = pager_page_latch(pager, page_num);
+    if (mode == LATCH_SHARED) {
+        latch->lock_shared();
+    } else {
+        latch->lock();
+    }
+}
+
+void pager_unlatch(Pager* pager, uint32_t page_num, LatchMode mode) {
+    shared_mutex* latch = pager_page_latch(pager, page_num);
+    if (mode == LATCH_SHARED) {
+        latch->unlock_shared();
+    } else {
+        latch->unlock();
+    }
+}
+
+/*
+Mutating paths call this on every page they change. Only dirty
+frames are written back on eviction or by pager_flush_all.
+*/
+void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        // 脏页由内核跟踪，这里只记录给 WAL
+        if (pager->wal) {
+            pager->txn_pages.push_back(page_num);
+        }
+        return;
+    }
+    unique_lock<shared_mutex> lock(pager->mutex);
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end()) {
+        cout << "Tried to mark uncached page " << page_num << " dirty" << endl;
+        exit(EXIT_FAILURE);
+    }
+    Frame* frame = &pager->frames[it->second];
+    frame->dirty = true;
+    if (pager->wal && !frame->in_txn) {
+        frame->in_txn = true;
+        pager->txn_pages.push_back(page_num);
+    }
+}
+
+/*
+End of statement: log an image of every page the statement changed.
+Until then those frames cannot be evicted, so the db file never
+holds a page whose statement is not in the WAL. The frames stay
+pinned by in_txn while they are being logged, so readers can keep
+evicting other pages meanwhile. Only the writer commits.
+*/
+void pager_commit(Pager* pager) {
+    if (pager->wal == NULL || pager->txn_pages.empty()) {
+        return;
+    }
+    sort(pager->txn_pages.begin(), pager->txn_pages.end());
+    pager->txn_pages.erase(unique(pager->txn_pages.begin(), pager->txn_pages.end()),
+                           pager->txn_pages.end());
+    vector<void*> pages;
+    pages.reserve(pager->txn_pages.size());
+    {
+        shared_lock<shared_mutex> lock(pager->mutex);
+        for (uint32_t page_num : pager->txn_pages) {
+            if (pager->mode == PAGER_MMAP) {
+                pages.push_back(pager->map + (off_t)page_num * PAGE_SIZE);
+                continue;
+            }
+            pages.push_back(pager->frames[pager->page_table.at(page_num)].data);
+        }
+    }
+    wal_commit(pager->wal, pager->txn_pages.data(), pages.data(),
+               pager->txn_pages.size(), pager->num_pages);
+    if (pager->mode == PAGER_BUFFERED) {
+        unique_lock<shared_mutex> lock(pager->mutex);
+        for (uint32_t page_num : pager->txn_pages) {
+            pager->frames[pager->page_table.at(page_num)].in_txn = false;
+        }
+    }
+    pager->txn_pages.clear();
+    if (pager->wal->num_frames >= WAL_CHECKPOINT_FRAMES) {
+        pager_checkpoint(pager);
+    }
+}
+
+/*
+Statements that touch many pages (bulk load, range delete) commit
+part-way once they hold max_pages uncommitted pages, or a quarter of
+the pool, since those frames cannot be evicted until then. Callers
+only do this where the tree is consistent.
+*/
+void pager_commit_partial(Pager* pager, uint32_t max_pages) {
+    uint32_t limit = max_pages;
+    if (pager->mode == PAGER_BUFFERED) {
+        // 未提交的页不能被淘汰，留出足够的空闲帧
+        limit = min(limit, pager->num_frames / 4);
+    }
+    if (pager->txn_pages.size() >= limit) {
+        pager_commit(pager);
+    }
+}
+
+/*
+Copy every committed page into the db file, make it durable and
+start a new log.
+*/
+void pager_checkpoint(Pager* pager) {
+    pager_flush_all(pager);
+    if (pager->wal == NULL) {
+        return;
+    }
+    if (fsync(pager->file_descriptor) == -1) {
+        cout << "Error syncing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    wal_reset(pager->wal);
+}
+
+/*
+Pick a frame for a new page: hand out never-used frames first,
+then run the CLOCK hand over unpinned frames. The victim still holds
+its page, dirty or not; the caller evicts it (and writes it back)
+before reusing the frame. The caller holds pager->mutex exclusively.
+*/
+uint32_t pager_find_victim(Pager* pager) {
+    if (pager->num_used_frames < pager->num_frames) {
+        return pager->num_used_frames++;
+    }
+    /* Two sweeps give every reference bit the chance to be cleared once */
+    for (uint32_t i = 0; i < 2 * pager->num_frames; i++) {
+        uint32_t frame_index = pager->clock_hand;
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+        Frame* frame = &pager->frames[frame_index];
+        if (frame->pin_count > 0 || frame->in_txn) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        return frame_index;
+    }
+    cout << "Buffer pool exhausted: all " << pager->num_frames << " frames are pinned." << endl;
+    exit(EXIT_FAILURE);
+}
+
+void print_pager_stats(Pager* pager) {
+    shared_lock<shared_mutex> lock(pager->mutex);
+    PagerStats* stats = &pager->stats;
+    if (pager->mode == PAGER_MMAP) {
+        cout << "mode: mmap\n";
+        cout << "mapped_pages: " << pager->map_length / PAGE_SIZE << "\n";
+        cout << "page_fetches: " << stats->hits << "\n";
+        cout << "write_calls: " << stats->write_calls << "\n";
+        cout << "readahead_calls: " << stats->readahead_calls << "\n";
+        cout << "readahead_pages: " << stats->readahead_pages << endl;
+        return;
+    }
+    uint32_t pinned = 0;
+    uint32_t dirty = 0;
+    for (uint32_t i = 0; i < pager->num_used_frames; i++) {
+        if (pager->frames[i].pin_count > 0) {
+            pinned++;
+        }
+        if (pager->frames[i].dirty) {
+            dirty++;
+        }
+    }
+    uint64_t lookups = stats->hits + stats->misses;
+    cout << "frames: " << pager->num_used_frames << "/" << pager->num_frames << "\n";
+    cout << "pinned: " << pinned << "\n";
+    cout << "dirty: " << dirty << "\n";
+    cout << "hits: " << stats->hits << "\n";
+    cout << "misses: " << stats->misses << "\n";
+    cout << "hit_ratio: " << (lookups ? (double)stats->hits / lookups : 0.0) << "\n";
+    cout << "evictions: " << stats->evictions << "\n";
+    cout << "write_backs: " << stats->write_backs << "\n";
+    cout << "pages_written: " << stats->pages_written << "\n";
+    cout << "write_calls: " << stats->write_calls << "\n";
+    cout << "readahead_calls: " << stats->readahead_calls << "\n";
+    cout << "readahead_pages: " << stats->readahead_pages << endl;
+    print_page_io_stats(pager->io);
+}
+
+/*
+Throughput of full-table scans, measured around execute_select.
+Useful for tuning --readahead on a cold page cache.
+*/
+void print_scan_stats(Table* table) {
+    lock_guard<mutex> lock(table->scan_stats_mutex);
+    ScanStats* stats = &table->scan_stats;
+    double seconds = stats->nanoseconds / 1e9;
+    cout << "scans: " << stats->scans << "\n";
+    cout << "scan_rows: " << stats->rows << "\n";
+    cout << "scan_leaves: " << stats->leaves << "\n";
+    cout << "scan_rows_per_sec: " << (seconds > 0 ? (uint64_t)(stats->rows / seconds) : 0) << "\n";
+    cout << "scan_mb_per_sec: "
+         << (seconds > 0 ? stats->leaves * PAGE_SIZE / seconds / (1024 * 1024) : 0.0) << "\n";
+    cout << "index_lookups: " << stats->index_lookups << endl;
+}
+
+/*
+Called whenever a scan steps from the cursor's leaf onto page_num.
+Forward steps that land within PAGER_READAHEAD_MAX_GAP pages extend
+the cursor's sequential run; anything else resets it. While the run
+lasts, the window ahead of the scan is topped up whenever less than
+half of it is left, so the kernel reads in large batches while we
+consume pages. The run is kept per cursor so that concurrent scans do
+not break each other's, and the pager is only locked to issue a read.
+*/
+void cursor_readahead(Cursor* cursor, uint32_t page_num) {
+    Pager* pager = cursor->table->pager;
+    if (pager->readahead_pages == 0) {
+        return;
+    }
+    uint32_t last = cursor->page_num;
+    if (page_num > last && page_num - last <= PAGER_READAHEAD_MAX_GAP) {
+        cursor->sequential_run += 1;
+    } else {
+        cursor->sequential_run = 0;
+        cursor->readahead_end = 0;
+    }
+    if (cursor->sequential_run < PAGER_READAHEAD_TRIGGER) {
+        return;
+    }
+    if (cursor->readahead_end > page_num + pager->readahead_pages / 2) {
+        return;
+    }
+
+    unique_lock<shared_mutex> lock(pager->mutex);
+    // 只预读文件里已经存在的页
+    uint32_t file_pages = pager->mode == PAGER_MMAP ? pager->map_length / PAGE_SIZE
+                                                     : pager->file_length / PAGE_SIZE;
+    uint32_t start = max(page_num + 1, cursor->readahead_end);
+    uint32_t end = min(page_num + 1 + pager->readahead_pages, file_pages);
+    bool into_pool = pager->mode == PAGER_BUFFERED && pager->io->uring;
+    if (into_pool) {
+        end = min(end, start + pager_prefetch_budget(pager));
+    }
+    if (start >= end) {
+        return;
+    }
+    off_t offset = (off_t)start * PAGE_SIZE;
+    size_t length = (size_t)(end - start) * PAGE_SIZE;
+    if (pager->mode == PAGER_MMAP) {
+        madvise(pager->map + offset, length, MADV_WILLNEED);
+    } else if (into_pool) {
+        vector<uint32_t> page_nums;
+        for (uint32_t n = start; n < end; n++) {
+            page_nums.push_back(n);
+        }
+        pager_prefetch_locked(pager, page_nums.data(), page_nums.size());
+    } else {
+        posix_fadvise(pager->file_descriptor, offset, length, POSIX_FADV_WILLNEED);
+    }
+    cursor->readahead_end = end;
+    pager->stats.readahead_calls += 1;
+    pager->stats.readahead_pages += end - start;
+}
+
+/*
+Decode the row under the cursor. The cursor keeps its current leaf
+pinned, so the page can be read without taking another pin.
+*/
+void cursor_row(Cursor* cursor, Row* row) {
     uint32_t page_num = cursor->page_num;
     void* page = get_page(cursor->table->pager, page_num);
-    return leaf_node_value(page, cursor->cell_num);
+    pager_unpin(cursor->table->pager, page_num);
+    row->id = *leaf_node_key(page, cursor->cell_num);
+    deserialize_row(leaf_node_value(page, cursor->cell_num), row);
 }
 
-void cursor_advance(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
-    cursor->cell_num += 1;
-    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        /* Advance to next leaf node */
+/*
+If the cursor is past the last cell of its leaf, move it to the first
+row of the next non-empty leaf, or to the end of the table. Leaves
+below a single-child internal node can be empty after deletes.
+The path recorded by table_find no longer applies once it moves.
+*/
+void cursor_settle(Cursor* cursor) {
+    while (true) {
+        uint32_t page_num = cursor->page_num;
+        void* node = get_page(cursor->table->pager, page_num);
+        if (cursor->cell_num < *leaf_node_num_cells(node)) {
+            pager_unpin(cursor->table->pager, page_num);
+            return;
+        }
         uint32_t next_page_num = *leaf_node_next_leaf(node);
         if (next_page_num == 0) {
             /* This was rightmost leaf */
             cursor->end_of_table = true;
-        } else {
-            cursor->page_num = next_page_num;
-            cursor->cell_num = 0;
+            pager_unpin(cursor->table->pager, page_num);
+            return;
         }
+        /* Move the cursor's pin and latch over to the next leaf, coupling them */
+        cursor_readahead(cursor, next_page_num);
+        get_page(cursor->table->pager, next_page_num);
+        if (cursor->latch_mode != LATCH_NONE) {
+            pager_latch(cursor->table->pager, next_page_num, cursor->latch_mode);
+            pager_unlatch(cursor->table->pager, page_num, cursor->latch_mode);
+        }
+        pager_unpin(cursor->table->pager, page_num);
+        pager_unpin(cursor->table->pager, page_num);
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
     }
 }
 
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-    Row* row_to_insert = &(statement->row_to_insert);
+void cursor_advance(Cursor* cursor) {
+    cursor->cell_num += 1;
+    cursor_settle(cursor);
+}
+
+void cursor_close(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    if (cursor->latch_mode != LATCH_NONE) {
+        for (uint32_t i = cursor->latched_from; i < cursor->depth; i++) {
+            pager_unlatch(pager, cursor->ancestors[i], cursor->latch_mode);
+            pager_unpin(pager, cursor->ancestors[i]);
+        }
+        pager_unlatch(pager, cursor->page_num, cursor->latch_mode);
+    }
+    pager_unpin(pager, cursor->page_num);
+    free(cursor);
+}
+
+static void index_add_row(Table* table, Row* row) {
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        Table* index = table->indexes[column];
+        if (index != NULL) {
+            index_insert(index, index_column_value(row, (IndexColumn)column), row->id);
+        }
+    }
+}
+
+static void index_remove_row(Table* table, Row* row) {
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        Table* index = table->indexes[column];
+        if (index != NULL) {
+            index_delete(index, index_column_value(row, (IndexColumn)column), row->id);
+        }
+    }
+}
+
+/* Move the index entries of the columns that changed */
+static void index_update_row(Table* table, Row* old_row, Row* new_row) {
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        Table* index = table->indexes[column];
+        const char* old_value = index_column_value(old_row, (IndexColumn)column);
+        const char* new_value = index_column_value(new_row, (IndexColumn)column);
+        if (index != NULL && strcmp(old_value, new_value) != 0) {
+            index_delete(index, old_value, old_row->id);
+            index_insert(index, new_value, new_row->id);
+        }
+    }
+}
+
+static ExecuteResult btree_insert(Table* table, Row* row_to_insert) {
     uint32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table, key_to_insert);
+    Cursor* cursor = table_find_for_write(table, key_to_insert, STATEMENT_INSERT);
+    void* node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = (*leaf_node_num_cells(node));
     if (cursor->cell_num < num_cells) {
         uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
         if (key_at_index == key_to_insert) {
+            pager_unpin(table->pager, cursor->page_num);
+            cursor_close(cursor);
             return EXECUTE_DUPLICATE_KEY;
         }
     }
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-    free(cursor);
+    pager_unpin(table->pager, cursor->page_num);
+    char record[ROW_MAX_SIZE];
+    uint32_t size = serialize_row(row_to_insert, record);
+    leaf_node_insert(cursor, row_to_insert->id, record, size);
+    cursor_close(cursor);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+    Row* row_to_insert = &(statement->row_to_insert);
+    ExecuteResult result = table->organization == TABLE_HASH ? hash_insert(table, row_to_insert)
+                                                             : btree_insert(table, row_to_insert);
+    if (result == EXECUTE_SUCCESS) {
+        index_add_row(table, row_to_insert);
+    }
+    return result;
+}
+
+/*
+Hash tables delete a single id straight from its bucket; a range has
+to find its ids by reading every bucket first.
+*/
+static ExecuteResult execute_delete_hash(Statement* statement, Table* table) {
+    Row row;
+    if (statement->single_row) {
+        if (!hash_delete(table, statement->range_start, &row)) {
+            return EXECUTE_KEY_NOT_FOUND;
+        }
+        index_remove_row(table, &row);
+        return EXECUTE_SUCCESS;
+    }
+    vector<Row> rows;
+    if (statement->range_start <= statement->range_end) {
+        hash_collect(table, statement->range_start, statement->range_end, &rows);
+    }
+    for (Row& found : rows) {
+        hash_delete(table, found.id, &row);
+        index_remove_row(table, &row);
+        pager_commit_partial(table->pager, DELETE_RANGE_COMMIT_PAGES);
+    }
     return EXECUTE_SUCCESS;
 }
 
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+/*
+Delete every row with range_start <= id <= range_end, along with its
+index entries. Each row is looked up from the root for writing so that
+the cursor carries the path its rebalancing needs, latched. When the
+next row is in a later leaf it is found with a shared cursor first.
+delete <id> of a missing row is an error; an empty range is not.
+*/
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+    if (table->organization == TABLE_HASH) {
+        return execute_delete_hash(statement, table);
+    }
+    uint32_t key = statement->range_start;
+    uint64_t deleted = 0;
+    while (key <= statement->range_end) {
+        Cursor* cursor = table_find_for_write(table, key, STATEMENT_DELETE);
+        void* node = get_page(table->pager, cursor->page_num);
+        bool in_leaf = cursor->cell_num < *leaf_node_num_cells(node);
+        uint32_t found_key = in_leaf ? *leaf_node_key(node, cursor->cell_num) : 0;
+        pager_unpin(table->pager, cursor->page_num);
+        if (!in_leaf) {
+            // 下一个 key 在后面的叶子里，找到它之后重新查找以拿到它的路径
+            cursor_close(cursor);
+            Cursor* next = table_find(table, key);
+            cursor_settle(next);
+            if (next->end_of_table) {
+                cursor_close(next);
+                break;
+            }
+            node = get_page(table->pager, next->page_num);
+            found_key = *leaf_node_key(node, next->cell_num);
+            pager_unpin(table->pager, next->page_num);
+            cursor_close(next);
+            if (found_key > statement->range_end) {
+                break;
+            }
+            cursor = table_find_for_write(table, found_key, STATEMENT_DELETE);
+        } else if (found_key > statement->range_end) {
+            cursor_close(cursor);
+            break;
+        }
+        Row row;
+        cursor_row(cursor, &row);
+        bool stranded = leaf_node_delete(cursor);
+        cursor_close(cursor);
+        if (stranded) {
+            btree_rebalance_leaf(table, found_key);
+        }
+        index_remove_row(table, &row);
+        deleted++;
+        if (found_key == UINT32_MAX) {
+            break;
+        }
+        key = found_key + 1;
+        pager_commit_partial(table->pager, DELETE_RANGE_COMMIT_PAGES);
+    }
+    if (deleted == 0 && statement->single_row) {
+        return EXECUTE_KEY_NOT_FOUND;
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/*
+The row is replaced in its leaf while the leaf is latched exclusively,
+so a reader sees either the old row or the new one. The cursor is
+found as for an insert: a longer row that no longer fits is taken out
+and put back through a split, still under the same latches.
+*/
+static ExecuteResult btree_update(Table* table, Row* row, Row* old_row) {
+    Pager* pager = table->pager;
+    Cursor* cursor = table_find_for_write(table, row->id, STATEMENT_INSERT);
+    void* node = get_page(pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node) || *leaf_node_key(node, cursor->cell_num) != row->id) {
+        pager_unpin(pager, cursor->page_num);
+        cursor_close(cursor);
+        return EXECUTE_KEY_NOT_FOUND;
+    }
+    cursor_row(cursor, old_row);
+    char record[ROW_MAX_SIZE];
+    uint32_t size = serialize_row(row, record);
+    if (leaf_node_update_cell(node, cursor->cell_num, record, size)) {
+        pager_mark_dirty(pager, cursor->page_num);
+        pager_unpin(pager, cursor->page_num);
+    } else {
+        leaf_node_remove_cell(node, cursor->cell_num);
+        pager_unpin(pager, cursor->page_num);
+        leaf_node_split_and_insert(cursor, row->id, record, size);
+    }
+    cursor_close(cursor);
+    return EXECUTE_SUCCESS;
+}
+
+/* Replace the row with row->id and its index entries; writer only */
+ExecuteResult table_update(Table* table, Row* row) {
+    Row old_row;
+    ExecuteResult result = table->organization == TABLE_HASH ? hash_update(table, row, &old_row)
+                                                             : btree_update(table, row, &old_row);
+    if (result == EXECUTE_SUCCESS) {
+        index_update_row(table, &old_row, row);
+    }
+    return result;
+}
+
+void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, const void* value, uint32_t size) {
     /*
-    Create a new node and move half the cells over.
+    Create a new node and move about half the bytes over.
     Insert the new value in one of the two nodes.
     Update parent or create a new parent.
     */
-    void* old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void* new_node = get_page(cursor->table->pager, new_page_num);
+    Pager* pager = cursor->table->pager;
+    void* old_node = get_page(pager, cursor->page_num);
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
     initialize_leaf_node(new_node);
-    *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    /* Line up all existing cells plus the new one, reading from a copy of the old node */
+    char copy[PAGE_SIZE];
+    memcpy(copy, old_node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(copy);
+    vector<uint32_t> keys;
+    vector<const void*> values;
+    vector<uint32_t> sizes;
+    uint32_t total_bytes = 0;
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        if (i == cursor->cell_num) {
+            keys.push_back(key);
+            values.push_back(value);
+            sizes.push_back(size);
+        }
+        if (i < num_cells) {
+            keys.push_back(*leaf_node_key(copy, i));
+            values.push_back(leaf_node_value(copy, i));
+            sizes.push_back(leaf_node_value_size(copy, i));
+        }
+        total_bytes += sizes.back() + LEAF_NODE_CELL_OVERHEAD;
+    }
+
     /*
-    All existing keys plus new key should be divided
-    evenly between old (left) and new (right) nodes.
-    Starting from the right, move each key to correct position.
+    Appending past the end of the rightmost leaf (ascending ids) would
+    leave the old leaf half empty for good, since no later key lands
+    in it. Keep the old leaf full and start the new one with just the
+    new key instead. Otherwise split where the left half reaches half
+    of the bytes, keeping at least one cell on each side.
     */
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
+    bool appending = cursor->cell_num == num_cells && *leaf_node_next_leaf(old_node) == 0;
+    uint32_t left_count = num_cells;
+    if (!appending) {
+        uint32_t left_bytes = 0;
+        left_count = 0;
+        while (left_bytes < total_bytes / 2) {
+            left_bytes += sizes[left_count] + LEAF_NODE_CELL_OVERHEAD;
+            left_count++;
         }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, index_within_node);
-        if (i == cursor->cell_num) {
-            serialize_row(value, leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+        left_count = min(max(left_count, 1u), num_cells);
+    }
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+    *leaf_node_num_cells(old_node) = 0;
+    *leaf_node_heap_start(old_node) = PAGE_SIZE;
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        if (i < left_count) {
+            leaf_node_insert_cell(old_node, i, keys[i], values[i], sizes[i]);
         } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            leaf_node_insert_cell(new_node, i - left_count, keys[i], values[i], sizes[i]);
         }
     }
-    /* Update cell count on both leaf nodes */
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
+    pager_mark_dirty(pager, cursor->page_num);
+    pager_mark_dirty(pager, new_page_num);
+    bool old_is_root = is_node_root(old_node);
+    uint32_t left_max = keys[left_count - 1];
+    pager_unpin(pager, cursor->page_num);
+    pager_unpin(pager, new_page_num);
+    if (old_is_root) {
+        return create_new_root(cursor->table, new_page_num, left_max);
     } else {
-        uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
-        void* parent = get_page(cursor->table->pager, parent_page_num);
-        update_internal_node_key(parent, old_max, new_max);
-        internal_node_insert(cursor->table, parent_page_num, new_page_num);
+        internal_node_insert(cursor, cursor->depth - 1, left_max, new_page_num);
         return;
     }
 }
 
-uint32_t* node_parent(void* node) { 
-    return (uint32_t*)((char*)node + PARENT_POINTER_OFFSET); 
+uint32_t* db_header_magic(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_MAGIC_OFFSET);
+}
+uint32_t* db_header_version(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_VERSION_OFFSET);
+}
+uint32_t* db_header_root_page(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_ROOT_PAGE_OFFSET);
+}
+uint32_t* db_header_freelist_trunk(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_FREELIST_TRUNK_OFFSET);
+}
+uint32_t* db_header_freelist_count(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_FREELIST_COUNT_OFFSET);
+}
+uint32_t* db_header_index_root(void* header, IndexColumn column) {
+    return (uint32_t*)((char*)header + DB_HEADER_INDEX_ROOTS_OFFSET) + column;
+}
+uint32_t* db_header_organization(void* header) {
+    return (uint32_t*)((char*)header + DB_HEADER_ORGANIZATION_OFFSET);
+}
+uint32_t* freelist_trunk_next(void* trunk) {
+    return (uint32_t*)((char*)trunk + FREELIST_TRUNK_NEXT_OFFSET);
+}
+uint32_t* freelist_trunk_num_leaves(void* trunk) {
+    return (uint32_t*)((char*)trunk + FREELIST_TRUNK_NUM_LEAVES_OFFSET);
+}
+uint32_t* freelist_trunk_leaf(void* trunk, uint32_t leaf_num) {
+    return (uint32_t*)((char*)trunk + FREELIST_TRUNK_LEAVES_OFFSET + leaf_num * sizeof(uint32_t));
+}
+
+/*
+Allocate a page: reuse one from the freelist if there is any,
+otherwise extend the file. The page number is reserved on return.
+*/
+uint32_t get_unused_page_num(Pager* pager) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t trunk_page_num = *db_header_freelist_trunk(header);
+    if (trunk_page_num == 0) {
+        pager_unpin(pager, DB_HEADER_PAGE_NUM);
+        unique_lock<shared_mutex> lock(pager->mutex);
+        return pager->num_pages++;
+    }
+    void* trunk = get_page(pager, trunk_page_num);
+    uint32_t num_leaves = *freelist_trunk_num_leaves(trunk);
+    uint32_t page_num;
+    if (num_leaves > 0) {
+        page_num = *freelist_trunk_leaf(trunk, num_leaves - 1);
+        *freelist_trunk_num_leaves(trunk) = num_leaves - 1;
+        pager_mark_dirty(pager, trunk_page_num);
+    } else {
+        // trunk 页自己也被分配出去
+        page_num = trunk_page_num;
+        *db_header_freelist_trunk(header) = *freelist_trunk_next(trunk);
+    }
+    *db_header_freelist_count(header) -= 1;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    pager_unpin(pager, trunk_page_num);
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
+    return page_num;
+}
+
+/*
+Return a page to the freelist. It becomes a leaf of the first trunk,
+or a new trunk when that one is full.
+*/
+void free_page(Pager* pager, uint32_t page_num) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t trunk_page_num = *db_header_freelist_trunk(header);
+    bool added = false;
+    if (trunk_page_num != 0) {
+        void* trunk = get_page(pager, trunk_page_num);
+        uint32_t num_leaves = *freelist_trunk_num_leaves(trunk);
+        if (num_leaves < FREELIST_TRUNK_MAX_LEAVES) {
+            *freelist_trunk_leaf(trunk, num_leaves) = page_num;
+            *freelist_trunk_num_leaves(trunk) = num_leaves + 1;
+            pager_mark_dirty(pager, trunk_page_num);
+            added = true;
+        }
+        pager_unpin(pager, trunk_page_num);
+    }
+    if (!added) {
+        void* trunk = get_page(pager, page_num);
+        *freelist_trunk_next(trunk) = trunk_page_num;
+        *freelist_trunk_num_leaves(trunk) = 0;
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+        *db_header_freelist_trunk(header) = page_num;
+    }
+    *db_header_freelist_count(header) += 1;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
+}
+
+/* Printed after the pager stats so reading the header is not counted there */
+void print_freelist_stats(Pager* pager) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    cout << "pages: " << pager->num_pages << "\n";
+    cout << "free_pages: " << *db_header_freelist_count(header) << endl;
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
 }
 
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+/*
+Give trailing free pages back to the file system. The freelist is
+rebuilt from the free pages that remain below the new end of file.
+Returns the number of pages released.
+*/
+uint32_t pager_truncate_free_pages(Pager* pager) {
+    vector<uint32_t> free_pages;
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t trunk_page_num = *db_header_freelist_trunk(header);
+    while (trunk_page_num != 0) {
+        void* trunk = get_page(pager, trunk_page_num);
+        free_pages.push_back(trunk_page_num);
+        for (uint32_t i = 0; i < *freelist_trunk_num_leaves(trunk); i++) {
+            free_pages.push_back(*freelist_trunk_leaf(trunk, i));
+        }
+        uint32_t next = *freelist_trunk_next(trunk);
+        pager_unpin(pager, trunk_page_num);
+        trunk_page_num = next;
+    }
+    sort(free_pages.begin(), free_pages.end());
+
+    uint32_t new_num_pages = pager->num_pages;
+    while (!free_pages.empty() && free_pages.back() == new_num_pages - 1) {
+        free_pages.pop_back();
+        new_num_pages--;
+    }
+    uint32_t released = pager->num_pages - new_num_pages;
+    if (released == 0) {
+        pager_unpin(pager, DB_HEADER_PAGE_NUM);
+        return 0;
+    }
+
+    *db_header_freelist_trunk(header) = 0;
+    *db_header_freelist_count(header) = 0;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
+    for (uint32_t page_num : free_pages) {
+        free_page(pager, page_num);
+    }
+    pager_truncate(pager, new_num_pages);
+    return released;
 }
 
 /*
-Until we start recycling free pages, new pages will always
-go onto the end of the database file
+Shrink the file to num_pages. Cached copies of the dropped pages are
+discarded, and the new size is committed and checkpointed before the
+file itself is cut.
 */
-uint32_t get_unused_page_num(Pager* pager) { return pager->num_pages; }
+void pager_truncate(Pager* pager, uint32_t num_pages) {
+    if (pager->mode == PAGER_BUFFERED) {
+        pager_wait_io(pager);
+        unique_lock<shared_mutex> lock(pager->mutex);
+        for (uint32_t i = 0; i < pager->num_used_frames; i++) {
+            Frame* frame = &pager->frames[i];
+            if (frame->page_num == INVALID_PAGE_NUM || frame->page_num < num_pages) {
+                continue;
+            }
+            pager->page_table.erase(frame->page_num);
+            frame->page_num = INVALID_PAGE_NUM;
+            frame->dirty = false;
+            frame->in_txn = false;
+            frame->referenced = false;
+        }
+    }
+    pager->txn_pages.erase(remove_if(pager->txn_pages.begin(), pager->txn_pages.end(),
+                                     [num_pages](uint32_t p) { return p >= num_pages; }),
+                           pager->txn_pages.end());
+    {
+        unique_lock<shared_mutex> lock(pager->mutex);
+        pager->num_pages = num_pages;
+    }
+    pager_commit(pager);
+    pager_checkpoint(pager);
+
+    off_t new_length = (off_t)num_pages * PAGE_SIZE;
+    unique_lock<shared_mutex> lock(pager->mutex);
+    if (pager->mode == PAGER_MMAP && pager->map_length > new_length) {
+        off_t step = (off_t)PAGER_MMAP_GROW_PAGES * PAGE_SIZE;
+        off_t map_length = (new_length + step - 1) / step * step;
+        if (map_length < pager->map_length) {
+            // 超出文件末尾的部分重新变回预留区间
+            mmap(pager->map + map_length, pager->map_length - map_length, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+            pager->map_length = map_length;
+        }
+        // 映射内的页必须仍在文件内
+        new_length = pager->map_length;
+    }
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+        cout << "Error truncating db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = new_length;
+}
 
 
-void create_new_root(Table* table, uint32_t right_child_page_num) {
+void create_new_root(Table* table, uint32_t right_child_page_num, uint32_t left_child_max_key) {
     /*
     Handle splitting the root.
     Old root copied to new page, becomes left child.
@@ -366,25 +1371,19 @@ void create_new_root(Table* table, uint32_t right_child_page_num) {
     /* Left child has data copied from old root */
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
-    if (get_node_type(left_child) == NODE_INTERNAL) {
-        void* child;
-        for (int i = 0; i < *internal_node_num_keys(left_child); i++) {
-            child = get_page(table->pager, *internal_node_child(left_child,i));
-            *node_parent(child) = left_child_page_num;
-        }
-        child = get_page(table->pager, *internal_node_right_child(left_child));
-        *node_parent(child) = left_child_page_num;
-    }
     /* Root node is a new internal node with one key and two children */
     initialize_internal_node(root);
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
     *internal_node_key(root, 0) = left_child_max_key;
     *internal_node_right_child(root) = right_child_page_num;
-    *node_parent(left_child) = table->root_page_num;
-    *node_parent(right_child) = table->root_page_num;
+    pager_mark_dirty(table->pager, table->root_page_num);
+    pager_mark_dirty(table->pager, right_child_page_num);
+    pager_mark_dirty(table->pager, left_child_page_num);
+    pager_unpin(table->pager, table->root_page_num);
+    pager_unpin(table->pager, right_child_page_num);
+    pager_unpin(table->pager, left_child_page_num);
 }
 
 uint32_t* internal_node_num_keys(void* node) {
@@ -393,8 +1392,20 @@ uint32_t* internal_node_num_keys(void* node) {
 uint32_t* internal_node_right_child(void* node) {
     return (uint32_t*)((char*)node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
 }
-uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
-    return (uint32_t*)((char*)node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE);
+uint32_t* internal_node_key(void* node, uint32_t key_num) {
+    return (uint32_t*)((char*)node + INTERNAL_NODE_KEYS_OFFSET + key_num * INTERNAL_NODE_KEY_SIZE);
+}
+static uint32_t* internal_node_child_slot(void* node, uint32_t child_num) {
+    return (uint32_t*)((char*)node + INTERNAL_NODE_CHILDREN_OFFSET + child_num * INTERNAL_NODE_CHILD_SIZE);
+}
+
+/* Move count key/child pairs; the ranges may overlap */
+void internal_node_move_cells(void* destination, uint32_t destination_cell,
+                              void* source, uint32_t source_cell, uint32_t count) {
+    memmove(internal_node_key(destination, destination_cell), internal_node_key(source, source_cell),
+            count * INTERNAL_NODE_KEY_SIZE);
+    memmove(internal_node_child_slot(destination, destination_cell),
+            internal_node_child_slot(source, source_cell), count * INTERNAL_NODE_CHILD_SIZE);
 }
 
 uint32_t* internal_node_child(void* node, uint32_t child_num) {
@@ -410,7 +1421,7 @@ uint32_t* internal_node_child(void* node, uint32_t child_num) {
         }
         return right_child;
     } else {
-        uint32_t* child = internal_node_cell(node, child_num);
+        uint32_t* child = internal_node_child_slot(node, child_num);
         if (*child == INVALID_PAGE_NUM) {
             cout << "Tried to access child " << child_num << " of node, but was invalid page\n";
             exit(EXIT_FAILURE);
@@ -419,19 +1430,6 @@ uint32_t* internal_node_child(void* node, uint32_t child_num) {
     }
 }
 
-uint32_t* internal_node_key(void* node, uint32_t key_num) {
-  // return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
-    return (uint32_t*)((char*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE);
-}
-
-uint32_t get_node_max_key(Pager* pager, void* node) {
-    if (get_node_type(node) == NODE_LEAF) {
-        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
-    }
-    void* right_child = get_page(pager,*internal_node_right_child(node));
-    return get_node_max_key(pager, right_child);
-}
-
 
 bool is_node_root(void* node) {
     uint8_t value = *((uint8_t*)((char*)node + IS_ROOT_OFFSET));
@@ -442,19 +1440,140 @@ void set_node_root(void* node, bool is_root) {
     *((uint8_t*)((char*)node + IS_ROOT_OFFSET)) = value;
 }
 
+/*
+True when applying op to node cannot change its parent: an insert
+cannot split it and a delete cannot leave it underfull (or, for the
+root, with a single child).
+*/
+static bool btree_node_is_safe(Table* table, void* node, StatementType op) {
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t used = leaf_node_used_space(node);
+        if (op == STATEMENT_INSERT) {
+            return used + LEAF_NODE_MAX_CELL_SIZE <= LEAF_NODE_SPACE_FOR_CELLS;
+        }
+        return used >= LEAF_NODE_MIN_SPACE + LEAF_NODE_MAX_CELL_SIZE;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (op == STATEMENT_INSERT) {
+        return num_keys < table->internal_node_max_cells;
+    }
+    if (is_node_root(node)) {
+        return num_keys >= 2;
+    }
+    return num_keys > table->internal_node_max_cells / 2;
+}
+
+/*
+Walk down to the leaf for key, latching every internal node in
+path_mode and the leaf in leaf_mode before the node above is let go
+(see BTREE_MAX_HEIGHT). Shared paths drop the parent right away;
+exclusive ones hold on to the unsafe part of the path for op.
+
+Only the root changes between leaf and internal node, so the type of
+any other child can be read before latching it. The root can also
+move during a bulk load: once it is latched we check it is still the
+root and still of the type it was latched for.
+*/
+static Cursor* btree_descend(Table* table, uint32_t key, LatchMode path_mode, LatchMode leaf_mode,
+                             StatementType op) {
+    Pager* pager = table->pager;
+    uint32_t ancestors[BTREE_MAX_HEIGHT];
+    uint32_t child_indexes[BTREE_MAX_HEIGHT];
+    uint32_t depth = 0;
+    uint32_t latched_from = 0;
+    uint32_t page_num;
+    void* node;
+    LatchMode mode = path_mode;
+    while (true) {
+        page_num = table->root_page_num;
+        node = get_page(pager, page_num);
+        pager_latch(pager, page_num, mode);
+        LatchMode wanted = get_node_type(node) == NODE_LEAF ? leaf_mode : path_mode;
+        if (page_num == table->root_page_num && mode == wanted) {
+            break;
+        }
+        pager_unlatch(pager, page_num, mode);
+        pager_unpin(pager, page_num);
+        mode = wanted;
+    }
+    while (get_node_type(node) != NODE_LEAF) {
+        uint32_t child_index = internal_node_find_child(node, key);
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        if (depth == BTREE_MAX_HEIGHT) {
+            cout << "Tree is deeper than " << BTREE_MAX_HEIGHT << " levels." << endl;
+            exit(EXIT_FAILURE);
+        }
+        child_indexes[depth] = child_index;
+        ancestors[depth++] = page_num;
+        node = get_page(pager, child_page_num);
+        mode = get_node_type(node) == NODE_LEAF ? leaf_mode : path_mode;
+        pager_latch(pager, child_page_num, mode);
+        if (path_mode == LATCH_SHARED || btree_node_is_safe(table, node, op)) {
+            for (uint32_t i = latched_from; i < depth; i++) {
+                pager_unlatch(pager, ancestors[i], path_mode);
+                pager_unpin(pager, ancestors[i]);
+            }
+            latched_from = depth;
+        }
+        page_num = child_page_num;
+    }
+    // 游标自己 pin 住叶子，latch 留给游标
+    Cursor* cursor = leaf_node_find(table, page_num, key);
+    pager_unpin(pager, page_num);
+    cursor->depth = depth;
+    memcpy(cursor->ancestors, ancestors, depth * sizeof(uint32_t));
+    memcpy(cursor->child_indexes, child_indexes, depth * sizeof(uint32_t));
+    cursor->latch_mode = leaf_mode;
+    cursor->latched_from = latched_from;
+    return cursor;
+}
+
 /*
 Return the position of the given key.
 If the key is not present, return the position
-where it should be inserted
+where it should be inserted. The cursor holds a shared latch on its
+leaf, so it only reads.
 */
 Cursor* table_find(Table* table, uint32_t key) {
-    uint32_t root_page_num = table->root_page_num;
-    void* root_node = get_page(table->pager, root_page_num);
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
-    } else {
-        return internal_node_find(table, root_page_num, key);
+    return btree_descend(table, key, LATCH_SHARED, LATCH_SHARED, STATEMENT_SELECT);
+}
+
+/*
+Like table_find, for the writer about to apply op (STATEMENT_INSERT or
+STATEMENT_DELETE) at the cursor: the leaf and every node op may still
+change on its way up are latched exclusively. Most leaves have room
+to spare, so the first try only latches the leaf exclusively and the
+path shared, which does not keep readers out of the upper levels;
+only when the leaf turns out unsafe is the path latched again for
+real.
+*/
+Cursor* table_find_for_write(Table* table, uint32_t key, StatementType op) {
+    Cursor* cursor = btree_descend(table, key, LATCH_SHARED, LATCH_EXCLUSIVE, op);
+    void* leaf = get_page(table->pager, cursor->page_num);
+    bool safe = cursor->depth == 0 || btree_node_is_safe(table, leaf, op);
+    pager_unpin(table->pager, cursor->page_num);
+    if (safe) {
+        return cursor;
     }
+    cursor_close(cursor);
+    return btree_descend(table, key, LATCH_EXCLUSIVE, LATCH_EXCLUSIVE, op);
+}
+
+/* Point lookup; safe to call from any number of threads next to the writer */
+bool table_lookup(Table* table, uint32_t key, Row* row) {
+    if (table->organization == TABLE_HASH) {
+        return hash_lookup(table, key, row);
+    }
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) &&
+                 *leaf_node_key(node, cursor->cell_num) == key;
+    pager_unpin(table->pager, cursor->page_num);
+    if (found) {
+        cursor_row(cursor, row);
+    }
+    cursor_close(cursor);
+    return found;
 }
 
 uint32_t internal_node_find_child(void* node, uint32_t key) {
@@ -463,223 +1582,713 @@ uint32_t internal_node_find_child(void* node, uint32_t key) {
     the given key.
     */
     uint32_t num_keys = *internal_node_num_keys(node);
-    /* Binary search */
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys; /* there is one more child than key */
-    while (min_index != max_index) {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
-            min_index = index + 1;
-        }
-    }
-    return min_index;
+    /* There is one more child than key; num_keys means the right child */
+    return search_lower_bound(internal_node_key(node, 0), num_keys, key);
 }
 
-void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
-    /*
-    Add a new child/key pair to parent that corresponds to child
-    */
+/*
+The child at cursor->child_indexes[level] of node ancestors[level]
+has split: it keeps the keys up to left_max and right_page_num holds
+the rest. The right half inherits the child's old key (or its place
+as right child) and the left half gets left_max, so no key has to be
+looked up below this node.
+*/
+void internal_node_insert(Cursor* cursor, uint32_t level, uint32_t left_max, uint32_t right_page_num) {
+    Table* table = cursor->table;
+    uint32_t parent_page_num = cursor->ancestors[level];
+    uint32_t index = cursor->child_indexes[level];
     void* parent = get_page(table->pager, parent_page_num);
-    void* child = get_page(table->pager, child_page_num);
-    // uint32_t child_max_key = get_node_max_key(child);
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
-    uint32_t index = internal_node_find_child(parent, child_max_key);
     uint32_t original_num_keys = *internal_node_num_keys(parent);
-    // *internal_node_num_keys(parent) = original_num_keys + 1;
-    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-        internal_node_split_and_insert(table, parent_page_num, child_page_num);
+    if (original_num_keys >= table->internal_node_max_cells) {
+        pager_unpin(table->pager, parent_page_num);
+        internal_node_split_and_insert(cursor, level, left_max, right_page_num);
         return;
     }
 
-    uint32_t right_child_page_num = *internal_node_right_child(parent);
-    /*
-    An internal node with a right child of INVALID_PAGE_NUM is empty
-    */
-    if (right_child_page_num == INVALID_PAGE_NUM) {
-        *internal_node_right_child(parent) = child_page_num;
-        return;
-    }
-    void* right_child = get_page(table->pager, right_child_page_num);
-    /*
-    If we are already at the max number of cells for a node, we cannot increment
-    before splitting. Incrementing without inserting a new key/child pair
-    and immediately calling internal_node_split_and_insert has the effect
-    of creating a new key at (max_cells + 1) with an uninitialized value
-    */
     *internal_node_num_keys(parent) = original_num_keys + 1;
-    if (child_max_key > get_node_max_key(table->pager, right_child)) {
-        /* Replace right child */
-        *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) = get_node_max_key(table->pager, right_child);
-        *internal_node_right_child(parent) = child_page_num;
+    if (index == original_num_keys) {
+        /* The right child split; its left half moves into the last cell */
+        *internal_node_child(parent, original_num_keys) = *internal_node_right_child(parent);
+        *internal_node_key(parent, original_num_keys) = left_max;
+        *internal_node_right_child(parent) = right_page_num;
     } else {
         /* Make room for the new cell */
-        for (uint32_t i = original_num_keys; i > index; i--) {
-            void* destination = internal_node_cell(parent, i);
-            void* source = internal_node_cell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+        internal_node_move_cells(parent, index + 1, parent, index, original_num_keys - index);
+        *internal_node_key(parent, index) = left_max;
+        *internal_node_child(parent, index + 1) = right_page_num;
+    }
+    pager_mark_dirty(table->pager, parent_page_num);
+    pager_unpin(table->pager, parent_page_num);
+}
+
+/*
+Write children[start, end) and the keys between them into node. The
+last child becomes the right child, so its key is not stored.
+*/
+static void internal_node_fill(void* node, const vector<uint32_t>& children,
+                               const vector<uint32_t>& keys, uint32_t start, uint32_t end) {
+    initialize_internal_node(node);
+    *internal_node_num_keys(node) = end - start - 1;
+    for (uint32_t i = start; i < end - 1; i++) {
+        *internal_node_child(node, i - start) = children[i];
+        *internal_node_key(node, i - start) = keys[i];
+    }
+    *internal_node_right_child(node) = children[end - 1];
+}
+
+/* True when page_num is reached from the root by right children only */
+static bool on_rightmost_path(Pager* pager, uint32_t page_num, const uint32_t* ancestors, uint32_t depth) {
+    for (uint32_t i = depth; i > 0; i--) {
+        void* ancestor = get_page(pager, ancestors[i - 1]);
+        bool rightmost = *internal_node_right_child(ancestor) == page_num;
+        pager_unpin(pager, ancestors[i - 1]);
+        if (!rightmost) {
+            return false;
+        }
+        page_num = ancestors[i - 1];
+    }
+    return true;
+}
+
+/*
+Split a full internal node while adding right_page_num to it (see
+internal_node_insert). Every child of the node plus the new one is
+laid out in key order and the list is cut in half: the left half
+stays in the old page and the right half moves to a new page, which
+is then inserted into the parent with the left half's last key as
+separator. When the right child of a node on the rightmost path
+splits, the old page keeps all of its children and the new page
+starts with the new child alone, matching the append split in
+leaf_node_split_and_insert. When the root splits, the root page
+keeps its number and both halves move to new pages below it.
+*/
+void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t left_max, uint32_t right_page_num) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    uint32_t old_page_num = cursor->ancestors[level];
+    uint32_t index = cursor->child_indexes[level];
+    void* old_node = get_page(pager, old_page_num);
+
+    /* keys[i] bounds children[i]; the last child's key is never stored */
+    uint32_t num_keys = *internal_node_num_keys(old_node);
+    vector<uint32_t> children;
+    vector<uint32_t> keys;
+    children.reserve(num_keys + 2);
+    keys.reserve(num_keys + 2);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        children.push_back(*internal_node_child(old_node, i));
+        keys.push_back(*internal_node_key(old_node, i));
+    }
+    children.push_back(*internal_node_right_child(old_node));
+    keys.push_back(0);
+    children.insert(children.begin() + index + 1, right_page_num);
+    keys.insert(keys.begin() + index, left_max);
+
+    uint32_t total = children.size();
+    bool appending = index == num_keys && on_rightmost_path(pager, old_page_num, cursor->ancestors, level);
+    uint32_t left_count = appending ? total - 1 : (total + 1) / 2;
+    uint32_t separator = keys[left_count - 1];
+    bool splitting_root = is_node_root(old_node);
+    uint32_t left_page_num = splitting_root ? get_unused_page_num(pager) : old_page_num;
+    uint32_t new_right_page_num = get_unused_page_num(pager);
+
+    void* left = get_page(pager, left_page_num);
+    internal_node_fill(left, children, keys, 0, left_count);
+    pager_mark_dirty(pager, left_page_num);
+    pager_unpin(pager, left_page_num);
+    void* right = get_page(pager, new_right_page_num);
+    internal_node_fill(right, children, keys, left_count, total);
+    pager_mark_dirty(pager, new_right_page_num);
+    pager_unpin(pager, new_right_page_num);
+
+    if (splitting_root) {
+        initialize_internal_node(old_node);
+        set_node_root(old_node, true);
+        *internal_node_num_keys(old_node) = 1;
+        *internal_node_child(old_node, 0) = left_page_num;
+        *internal_node_key(old_node, 0) = separator;
+        *internal_node_right_child(old_node) = new_right_page_num;
+        pager_mark_dirty(pager, old_page_num);
+        pager_unpin(pager, old_page_num);
+        return;
+    }
+    pager_unpin(pager, old_page_num);
+    internal_node_insert(cursor, level - 1, separator, new_right_page_num);
+}
+
+/*
+Even out two adjacent leaves after a delete; separator_index is the
+left one's slot in parent. Returns true when everything fit in left,
+in which case right is empty and should be freed.
+*/
+static bool leaf_node_rebalance(void* left, void* right, void* parent, uint32_t separator_index) {
+    uint32_t left_used = leaf_node_used_space(left);
+    uint32_t right_used = leaf_node_used_space(right);
+    if (left_used + right_used <= LEAF_NODE_SPACE_FOR_CELLS) {
+        leaf_node_move_cells(left, *leaf_node_num_cells(left), right, 0, *leaf_node_num_cells(right));
+        *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+        return true;
+    }
+    /* Move single cells off the fuller side for as long as that narrows the difference */
+    while (left_used < right_used) {
+        uint32_t size = leaf_node_value_size(right, 0) + LEAF_NODE_CELL_OVERHEAD;
+        if (size >= right_used - left_used) {
+            break;
+        }
+        leaf_node_move_cells(left, *leaf_node_num_cells(left), right, 0, 1);
+        left_used += size;
+        right_used -= size;
+    }
+    while (right_used < left_used) {
+        uint32_t last = *leaf_node_num_cells(left) - 1;
+        uint32_t size = leaf_node_value_size(left, last) + LEAF_NODE_CELL_OVERHEAD;
+        if (size >= left_used - right_used) {
+            break;
+        }
+        leaf_node_move_cells(right, 0, left, last, 1);
+        left_used -= size;
+        right_used += size;
+    }
+    *internal_node_key(parent, separator_index) = *leaf_node_key(left, *leaf_node_num_cells(left) - 1);
+    return false;
+}
+
+/* Same as leaf_node_rebalance for two internal nodes */
+static bool internal_node_rebalance(Table* table, void* left, void* right, void* parent,
+                                    uint32_t separator_index) {
+    vector<uint32_t> children;
+    vector<uint32_t> keys;
+    void* halves[2] = {left, right};
+    for (void* node : halves) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        for (uint32_t i = 0; i < num_keys; i++) {
+            children.push_back(*internal_node_child(node, i));
+            keys.push_back(*internal_node_key(node, i));
+        }
+        children.push_back(*internal_node_right_child(node));
+        keys.push_back(0);
+    }
+    // 左节点的右孩子以父节点里的分隔 key 为上界
+    keys[*internal_node_num_keys(left)] = *internal_node_key(parent, separator_index);
+
+    uint32_t total = children.size();
+    if (total <= table->internal_node_max_cells + 1) {
+        internal_node_fill(left, children, keys, 0, total);
+        return true;
+    }
+    uint32_t left_count = total / 2;
+    internal_node_fill(left, children, keys, 0, left_count);
+    internal_node_fill(right, children, keys, left_count, total);
+    *internal_node_key(parent, separator_index) = keys[left_count - 1];
+    return false;
+}
+
+/*
+Drop separator index from node: the child left of it takes over the
+right one's slot (and key), so the right child disappears.
+*/
+static void internal_node_remove_separator(void* node, uint32_t index) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t left_child = *internal_node_child(node, index);
+    if (index + 1 == num_keys) {
+        *internal_node_right_child(node) = left_child;
+    } else {
+        internal_node_move_cells(node, index, node, index + 1, num_keys - index - 1);
+        *internal_node_child(node, index) = left_child;
+    }
+    *internal_node_num_keys(node) = num_keys - 1;
+}
+
+/* True when the cursor still holds the latch of page_num */
+static bool cursor_holds_latch(Cursor* cursor, uint32_t page_num) {
+    if (page_num == cursor->page_num) {
+        return true;
+    }
+    for (uint32_t i = cursor->latched_from; i < cursor->depth; i++) {
+        if (cursor->ancestors[i] == page_num) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+While the root is an internal node with a single child, pull that
+child up into the root page (the root keeps its page number). The
+cursor holds the root's latch; each child is latched before it is
+copied and freed.
+*/
+static void btree_collapse_root(Cursor* cursor) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    while (true) {
+        void* root = get_page(pager, table->root_page_num);
+        if (get_node_type(root) != NODE_INTERNAL || *internal_node_num_keys(root) > 0) {
+            pager_unpin(pager, table->root_page_num);
+            return;
+        }
+        uint32_t child_page_num = *internal_node_right_child(root);
+        void* child = get_page(pager, child_page_num);
+        bool held = cursor_holds_latch(cursor, child_page_num);
+        if (!held) {
+            pager_latch(pager, child_page_num, LATCH_EXCLUSIVE);
+        }
+        memcpy(root, child, PAGE_SIZE);
+        set_node_root(root, true);
+        pager_mark_dirty(pager, table->root_page_num);
+        free_page(pager, child_page_num);
+        if (!held) {
+            pager_unlatch(pager, child_page_num, LATCH_EXCLUSIVE);
+        }
+        pager_unpin(pager, child_page_num);
+        pager_unpin(pager, table->root_page_num);
+    }
+}
+
+/*
+The node at level of the cursor's path (0 is the root, cursor->depth
+the leaf) is underfull: rebalance it with a sibling, and continue
+upwards if a merge left the parent underfull. The node and its parent
+are latched by the cursor (both were unsafe on the way down); the
+sibling is latched here. Scans couple latches from left to right, so
+a left sibling is only latched after letting go of the node, which
+nobody else changes in the meantime.
+
+Returns true when the node had no sibling to rebalance with: its
+parent has a single child, as after an append split or a bulk load.
+The parent is rebalanced instead, and the caller has to look the node
+up again (see btree_rebalance_leaf) once the cursor is closed.
+*/
+bool btree_rebalance(Cursor* cursor, uint32_t level) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    uint32_t parent_page_num = cursor->ancestors[level - 1];
+    uint32_t index = cursor->child_indexes[level - 1];
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    if (num_keys == 0) {
+        // 父节点只有这一个孩子，它自己也不满：先合并父节点（或收起根）
+        pager_unpin(pager, parent_page_num);
+        if (level - 1 == 0) {
+            btree_collapse_root(cursor);
+        } else {
+            btree_rebalance(cursor, level - 1);
+        }
+        return true;
+    }
+    uint32_t separator_index = index > 0 ? index - 1 : 0;
+    uint32_t left_page_num = *internal_node_child(parent, separator_index);
+    uint32_t right_page_num = *internal_node_child(parent, separator_index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+    uint32_t sibling_page_num = index > 0 ? left_page_num : right_page_num;
+    if (sibling_page_num == left_page_num) {
+        pager_unlatch(pager, right_page_num, LATCH_EXCLUSIVE);
+        pager_latch(pager, left_page_num, LATCH_EXCLUSIVE);
+        pager_latch(pager, right_page_num, LATCH_EXCLUSIVE);
+    } else {
+        pager_latch(pager, right_page_num, LATCH_EXCLUSIVE);
+    }
+    bool merged;
+    if (get_node_type(left) == NODE_LEAF) {
+        merged = leaf_node_rebalance(left, right, parent, separator_index);
+    } else {
+        merged = internal_node_rebalance(table, left, right, parent, separator_index);
+    }
+    if (merged) {
+        internal_node_remove_separator(parent, separator_index);
+    }
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, right_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    if (merged) {
+        // 释放时仍持有它的 latch，别的线程不会再看到它
+        free_page(pager, right_page_num);
+    }
+    pager_unlatch(pager, sibling_page_num, LATCH_EXCLUSIVE);
+    pager_unpin(pager, left_page_num);
+    pager_unpin(pager, right_page_num);
+    uint32_t parent_num_keys = *internal_node_num_keys(parent);
+    pager_unpin(pager, parent_page_num);
+    if (!merged) {
+        return false;
+    }
+    if (level - 1 == 0) {
+        btree_collapse_root(cursor);
+    } else if (parent_num_keys < table->internal_node_max_cells / 2) {
+        btree_rebalance(cursor, level - 1);
+    }
+    return false;
+}
+
+/*
+Rebalance the leaf for key again after leaf_node_delete left it
+underfull under a parent with a single child. The path is looked up
+afresh, since the first rebalance changed the levels above; every
+round gives the leaf siblings one level further up, until it has one
+to merge with or becomes the root.
+*/
+void btree_rebalance_leaf(Table* table, uint32_t key) {
+    Pager* pager = table->pager;
+    while (true) {
+        Cursor* cursor = table_find_for_write(table, key, STATEMENT_DELETE);
+        void* node = get_page(pager, cursor->page_num);
+        uint32_t used = leaf_node_used_space(node);
+        pager_unpin(pager, cursor->page_num);
+        bool stranded = cursor->depth > 0 && used < LEAF_NODE_MIN_SPACE &&
+                        btree_rebalance(cursor, cursor->depth);
+        cursor_close(cursor);
+        if (!stranded) {
+            return;
+        }
+    }
+}
+
+/*
+The returned cursor holds a pin on its leaf; release it with cursor_close.
+*/
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+    void* node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    Cursor* cursor = static_cast<Cursor*>(malloc(sizeof(Cursor)));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->latch_mode = LATCH_NONE;
+    cursor->latched_from = 0;
+    cursor->sequential_run = 0;
+    cursor->readahead_end = 0;
+    cursor->cell_num = search_lower_bound(leaf_node_key(node, 0), num_cells, key);
+    return cursor;
+}
+
+
+NodeType get_node_type(void* node) {
+    uint8_t value = *((uint8_t*)((char*)node + NODE_TYPE_OFFSET));
+    return (NodeType)value;
+}
+
+void set_node_type(void* node, NodeType type) {
+    uint8_t value = type;
+    *((uint8_t*)((char*)node + NODE_TYPE_OFFSET)) = value;
+}
+
+static bool row_matches(Statement* statement, Row* row) {
+    return !statement->has_column_value ||
+           statement->column_value == index_column_value(row, statement->column);
+}
+
+/*
+select ... where <column> = <value> on an indexed column: take the
+candidate ids from the index and look up each row, keeping those that
+really match. Rows come out in id order, as from a scan.
+*/
+static ExecuteResult execute_select_by_index(Statement* statement, Table* table, Table* index,
+                                             ResultSink* sink) {
+    vector<uint32_t> ids;
+    index_lookup(index, statement->column_value.c_str(), &ids);
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    Row row;
+    uint64_t num_rows = 0;
+    for (uint32_t id : ids) {
+        if (num_rows == statement->limit) {
+            break;
+        }
+        if (id < statement->range_start || id > statement->range_end) {
+            continue;
+        }
+        if (table_lookup(table, id, &row) && row_matches(statement, &row)) {
+            result_sink_row(sink, &row);
+            num_rows++;
+        }
+    }
+    result_sink_flush(sink);
+    lock_guard<mutex> lock(table->scan_stats_mutex);
+    table->scan_stats.index_lookups += 1;
+    return EXECUTE_SUCCESS;
+}
+
+/*
+A hash table answers a single id from its bucket; anything wider reads
+every bucket and sorts what it finds, so rows still come out in id
+order.
+*/
+static ExecuteResult execute_select_hash(Statement* statement, Table* table, ResultSink* sink) {
+    auto start = chrono::steady_clock::now();
+    vector<Row> rows;
+    Row row;
+    if (statement->range_start == statement->range_end) {
+        if (hash_lookup(table, statement->range_start, &row)) {
+            rows.push_back(row);
+        }
+    } else {
+        hash_collect(table, statement->range_start, statement->range_end, &rows);
+    }
+    uint64_t num_rows = 0;
+    for (Row& found : rows) {
+        if (num_rows == statement->limit) {
+            break;
+        }
+        if (row_matches(statement, &found)) {
+            result_sink_row(sink, &found);
+            num_rows++;
+        }
+    }
+    result_sink_flush(sink);
+    lock_guard<mutex> lock(table->scan_stats_mutex);
+    ScanStats* stats = &table->scan_stats;
+    stats->scans += 1;
+    stats->rows += rows.size();
+    stats->nanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start).count();
+    return EXECUTE_SUCCESS;
+}
+
+/*
+Send rows with range_start <= id <= range_end to sink, at most limit of them.
+The cursor seeks straight to range_start and the scan stops at the
+first id past range_end, so a window costs one descent plus the
+leaves it covers. A condition on an indexed column goes through the
+index instead; on any other it filters the scanned rows.
+*/
+ExecuteResult execute_select(Statement* statement, Table* table, ResultSink* sink) {
+    auto start = chrono::steady_clock::now();
+    if (statement->range_start > statement->range_end || statement->limit == 0) {
+        return EXECUTE_SUCCESS;
+    }
+    if (statement->has_column_value) {
+        Table* index = table->indexes[statement->column];
+        if (index != NULL) {
+            return execute_select_by_index(statement, table, index, sink);
+        }
+    }
+    if (table->organization == TABLE_HASH) {
+        return execute_select_hash(statement, table, sink);
+    }
+    Cursor* cursor = table_find(table, statement->range_start);
+    cursor_settle(cursor);
+    Row row;
+    uint64_t num_rows = 0;
+    uint64_t num_scanned = 0;
+    uint64_t num_leaves = 1;
+    while (!(cursor->end_of_table) && num_rows < statement->limit) {
+        cursor_row(cursor, &row);
+        if (row.id > statement->range_end) {
+            break;
+        }
+        num_scanned++;
+        if (row_matches(statement, &row)) {
+            result_sink_row(sink, &row);
+            num_rows++;
+        }
+        uint32_t page_num = cursor->page_num;
+        cursor_advance(cursor);
+        if (cursor->page_num != page_num) {
+            num_leaves += 1;
         }
-        *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
     }
+    cursor_close(cursor);
+    result_sink_flush(sink);
+    lock_guard<mutex> lock(table->scan_stats_mutex);
+    ScanStats* stats = &table->scan_stats;
+    stats->scans += 1;
+    stats->rows += num_scanned;
+    stats->leaves += num_leaves;
+    stats->nanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start).count();
+    return EXECUTE_SUCCESS;
 }
 
-void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
-    uint32_t old_page_num = parent_page_num;
-    void* old_node = get_page(table->pager,parent_page_num);
-    uint32_t old_max = get_node_max_key(table->pager, old_node);
-    void* child = get_page(table->pager, child_page_num); 
-    uint32_t child_max = get_node_max_key(table->pager, child);
-    uint32_t new_page_num = get_unused_page_num(table->pager);
-    /*
-    Declaring a flag before updating pointers which
-    records whether this operation involves splitting the root -
-    if it does, we will insert our newly created node during
-    the step where the table's new root is created. If it does
-    not, we have to insert the newly created node into its parent
-    after the old node's keys have been transferred over. We are not
-    able to do this if the newly created node's parent is not a newly
-    initialized root node, because in that case its parent may have existing
-    keys aside from our old node which we are splitting. If that is true, we
-    need to find a place for our newly created node in its parent, and we
-    cannot insert it at the correct index if it does not yet have any keys
-    */
-    uint32_t splitting_root = is_node_root(old_node);
-    void* parent;
-    void* new_node;
-    if (splitting_root) {
-        create_new_root(table, new_page_num);
-        parent = get_page(table->pager,table->root_page_num);
-        /*
-        If we are splitting the root, we need to update old_node to point
-        to the new root's left child, new_page_num will already point to
-        the new root's right child
-        */
-        old_page_num = *internal_node_child(parent,0);
-        old_node = get_page(table->pager, old_page_num);
-    } else {
-        parent = get_page(table->pager,*node_parent(old_node));
-        new_node = get_page(table->pager, new_page_num);
-        initialize_internal_node(new_node);
+/* A handle on another B-tree in the table's file, such as an index */
+static Table* tree_open(Table* table, uint32_t root_page_num) {
+    Table* tree = new Table();
+    tree->pager = table->pager;
+    tree->root_page_num = root_page_num;
+    tree->internal_node_max_cells = table->internal_node_max_cells;
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        tree->indexes[column] = NULL;
     }
+    return tree;
+}
 
-    uint32_t* old_num_keys = internal_node_num_keys(old_node);
-    uint32_t cur_page_num = *internal_node_right_child(old_node);
-    void* cur = get_page(table->pager, cur_page_num);
-    /*
-    First put right child into new node and set right child of old node to invalid page number
-    */
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
-    *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-    /*
-    For each key until you get to the middle key, move the key and the child to the new node
-    */
-    for (int i = INTERNAL_NODE_MAX_CELLS - 1; i > INTERNAL_NODE_MAX_CELLS / 2; i--) {
-        cur_page_num = *internal_node_child(old_node, i);
-        cur = get_page(table->pager, cur_page_num);
-        internal_node_insert(table, new_page_num, cur_page_num);
-        *node_parent(cur) = new_page_num;
-        (*old_num_keys)--;
-    }
-    /*
-    Set child before middle key, which is now the highest key, to be node's right child,
-    and decrement number of keys
-    */
-    *internal_node_right_child(old_node) = *internal_node_child(old_node,*old_num_keys - 1);
-    (*old_num_keys)--;
-    /*
-    Determine which of the two nodes after the split should contain the child to be inserted,
-    and insert the child
-    */
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
-    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
-    internal_node_insert(table, destination_page_num, child_page_num);
-    *node_parent(child) = destination_page_num;
-    update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
-    if (!splitting_root) {
-        internal_node_insert(table,*node_parent(old_node),new_page_num);
-        *node_parent(new_node) = *node_parent(old_node);
+const char* index_column_value(Row* row, IndexColumn column) {
+    return column == INDEX_COLUMN_USERNAME ? row->username : row->email;
+}
+
+/* FNV-1a */
+uint32_t index_hash(const char* value) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = value; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
     }
+    return hash;
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_keys = *internal_node_num_keys(node);
-    /* Binary search to find index of child to search */
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys; /* there is one more child than key */
-    while (min_index != max_index) {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
-            min_index = index + 1;
-        }
+/*
+Append the ids of the list stored under key at the cursor to *ids and
+set *spilled if it continues under the next key. Returns false when
+there is no such list.
+*/
+static bool index_read_list(Cursor* cursor, uint32_t key, bool* spilled, vector<uint32_t>* ids) {
+    Pager* pager = cursor->table->pager;
+    void* node = get_page(pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) &&
+                 *leaf_node_key(node, cursor->cell_num) == key;
+    *spilled = false;
+    if (found) {
+        uint8_t* list = static_cast<uint8_t*>(leaf_node_value(node, cursor->cell_num));
+        uint32_t count = list[0] / sizeof(uint32_t);
+        *spilled = list[1] != 0;
+        size_t old_size = ids->size();
+        ids->resize(old_size + count);
+        memcpy(ids->data() + old_size, list + ROW_LENGTHS_SIZE, count * sizeof(uint32_t));
     }
-    uint32_t child_index = internal_node_find_child(node, key);
-    uint32_t child_num = *internal_node_child(node, child_index);
-    void* child = get_page(table->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
-        default:
-            __builtin_unreachable();
+    pager_unpin(pager, cursor->page_num);
+    return found;
+}
+
+/* Store a list under key at the cursor, replacing the one already there if replace */
+static void index_write_list(Cursor* cursor, uint32_t key, bool replace, bool spilled,
+                             const vector<uint32_t>& ids) {
+    uint8_t record[ROW_MAX_SIZE];
+    uint32_t ids_length = ids.size() * sizeof(uint32_t);
+    uint32_t next_key = key + 1;
+    record[0] = ids_length;
+    record[1] = spilled ? sizeof(next_key) : 0;
+    memcpy(record + ROW_LENGTHS_SIZE, ids.data(), ids_length);
+    memcpy(record + ROW_LENGTHS_SIZE + ids_length, &next_key, record[1]);
+    if (replace) {
+        // 先拿掉旧的再插入新的，放不下时照常分裂
+        void* node = get_page(cursor->table->pager, cursor->page_num);
+        leaf_node_remove_cell(node, cursor->cell_num);
+        pager_unpin(cursor->table->pager, cursor->page_num);
     }
+    leaf_node_insert(cursor, key, record, ROW_LENGTHS_SIZE + ids_length + record[1]);
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    Cursor* cursor = static_cast<Cursor*>(malloc(sizeof(Cursor)));
-    cursor->table = table;
-    cursor->page_num = page_num;
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index) {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
-        }
-        if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
+/* Add id to the first list with room, starting at the value's own key */
+void index_insert(Table* index, const char* value, uint32_t id) {
+    uint32_t key = index_hash(value);
+    vector<uint32_t> ids;
+    while (true) {
+        Cursor* cursor = table_find_for_write(index, key, STATEMENT_INSERT);
+        bool spilled;
+        ids.clear();
+        bool found = index_read_list(cursor, key, &spilled, &ids);
+        if (ids.size() < INDEX_LIST_MAX_IDS) {
+            ids.push_back(id);
+            index_write_list(cursor, key, found, spilled, ids);
+            cursor_close(cursor);
+            return;
         }
+        if (!spilled) {
+            // 列表满了，记下下一个 key 让查找跟过去
+            index_write_list(cursor, key, true, true, ids);
+        }
+        cursor_close(cursor);
+        key++;
     }
-    cursor->cell_num = min_index;
-    return cursor;
 }
 
-
-NodeType get_node_type(void* node) {
-    uint8_t value = *((uint8_t*)((char*)node + NODE_TYPE_OFFSET));
-    return (NodeType)value;
+/*
+Remove id from the lists of value. A list left empty is dropped unless
+it continues under the next key, since lookups still have to get past
+it.
+*/
+void index_delete(Table* index, const char* value, uint32_t id) {
+    uint32_t key = index_hash(value);
+    vector<uint32_t> ids;
+    while (true) {
+        Cursor* cursor = table_find_for_write(index, key, STATEMENT_DELETE);
+        bool spilled;
+        ids.clear();
+        index_read_list(cursor, key, &spilled, &ids);
+        auto it = find(ids.begin(), ids.end(), id);
+        if (it != ids.end()) {
+            ids.erase(it);
+            bool stranded = false;
+            if (ids.empty() && !spilled) {
+                stranded = leaf_node_delete(cursor);
+            } else {
+                index_write_list(cursor, key, true, spilled, ids);
+            }
+            cursor_close(cursor);
+            if (stranded) {
+                btree_rebalance_leaf(index, key);
+            }
+            return;
+        }
+        cursor_close(cursor);
+        if (!spilled) {
+            return;
+        }
+        key++;
+    }
 }
 
-void set_node_type(void* node, NodeType type) {
-    uint8_t value = type;
-    *((uint8_t*)((char*)node + NODE_TYPE_OFFSET)) = value;
+/* Collect the candidate ids for value; the caller checks the rows */
+void index_lookup(Table* index, const char* value, vector<uint32_t>* ids) {
+    uint32_t key = index_hash(value);
+    while (true) {
+        Cursor* cursor = table_find(index, key);
+        bool spilled;
+        index_read_list(cursor, key, &spilled, ids);
+        cursor_close(cursor);
+        if (!spilled) {
+            return;
+        }
+        key++;
+    }
 }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
+/* Add every row of table to index, committing along the way like a bulk load */
+void index_build(Table* table, Table* index, IndexColumn column) {
+    if (table->organization == TABLE_HASH) {
+        vector<Row> rows;
+        hash_collect(table, 0, UINT32_MAX, &rows);
+        for (Row& row : rows) {
+            index_insert(index, index_column_value(&row, column), row.id);
+            pager_commit_partial(table->pager, BULK_LOAD_COMMIT_PAGES);
+        }
+        return;
+    }
     Cursor* cursor = table_start(table);
     Row row;
     while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
+        cursor_row(cursor, &row);
+        index_insert(index, index_column_value(&row, column), row.id);
+        pager_commit_partial(table->pager, BULK_LOAD_COMMIT_PAGES);
         cursor_advance(cursor);
     }
-    free(cursor);
+    cursor_close(cursor);
+}
+
+/*
+Build an index on statement->column from the rows already in the
+table. The header only points at it, and selects only use it, once it
+is complete.
+*/
+ExecuteResult execute_create_index(Statement* statement, Table* table) {
+    if (table->indexes[statement->column] != NULL) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+    Pager* pager = table->pager;
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page(pager, root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    pager_mark_dirty(pager, root_page_num);
+    pager_unpin(pager, root_page_num);
+
+    Table* index = tree_open(table, root_page_num);
+    index_build(table, index, statement->column);
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    *db_header_index_root(header, statement->column) = root_page_num;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
+    table->indexes[statement->column] = index;
     return EXECUTE_SUCCESS;
 }
 
@@ -694,6 +2303,55 @@ void print_row(Row* row) {
     cout << "(" << row->id << ", " << row->username << ", " << row->email << ")" << endl;
 }
 
+// 一行格式化后最多这么长：ROW_MAX_SIZE 加上 id 的 10 位数字和分隔符
+static const uint32_t RESULT_SINK_MAX_ROW = ROW_MAX_SIZE + 32;
+
+void result_sink_init(ResultSink* sink, ostream* out, ResultFormat format) {
+    sink->out = out;
+    sink->format = format;
+    sink->used = 0;
+}
+
+static char* result_sink_append(char* p, const char* text, size_t length) {
+    memcpy(p, text, length);
+    return p + length;
+}
+
+void result_sink_row(ResultSink* sink, Row* row) {
+    if (RESULT_SINK_BUFFER_SIZE - sink->used < RESULT_SINK_MAX_ROW) {
+        result_sink_flush(sink);
+    }
+    char* p = sink->buffer + sink->used;
+    if (sink->format == RESULT_FORMAT_BINARY) {
+        memcpy(p, &row->id, sizeof(row->id));
+        p += sizeof(row->id);
+        p += serialize_row(row, p);
+    } else {
+        bool text = sink->format == RESULT_FORMAT_TEXT;
+        if (text) {
+            *p++ = '(';
+        }
+        p = to_chars(p, p + 10, row->id).ptr;
+        p = text ? result_sink_append(p, ", ", 2) : result_sink_append(p, "\t", 1);
+        p = result_sink_append(p, row->username, strlen(row->username));
+        p = text ? result_sink_append(p, ", ", 2) : result_sink_append(p, "\t", 1);
+        p = result_sink_append(p, row->email, strlen(row->email));
+        if (text) {
+            *p++ = ')';
+        }
+        *p++ = '\n';
+    }
+    sink->used = p - sink->buffer;
+}
+
+/* Pass the buffered rows to the stream; flushing the stream is left to its owner */
+void result_sink_flush(ResultSink* sink) {
+    if (sink->used > 0) {
+        sink->out->write(sink->buffer, sink->used);
+        sink->used = 0;
+    }
+}
+
 void print_page(Pager* pager, uint32_t page_num) {
     cout << "Page:\n";
     void* p = get_page(pager, page_num);
@@ -707,12 +2365,26 @@ void print_page(Pager* pager, uint32_t page_num) {
     }
     Row row;
     for (int i=0;i<num_cells;i++) {
+        row.id = *leaf_node_key(p, i);
         deserialize_row(leaf_node_value(p, i), &row);
         print_row(&row);
     }
+    pager_unpin(pager, page_num);
+}
+
+void db_options_init(DbOptions* options) {
+    options->mode = PAGER_BUFFERED;
+    options->num_frames = PAGER_DEFAULT_NUM_FRAMES;
+    options->use_wal = true;
+    options->wal_sync = WAL_SYNC_FULL;     // 语句返回前已经落盘，并发的提交共用一次 fsync
+    options->group_commit_ms = WAL_DEFAULT_GROUP_COMMIT_MS;
+    options->readahead_pages = PAGER_DEFAULT_READAHEAD_PAGES;
+    options->use_uring = true;
+    options->internal_node_max_cells = 0;
+    options->organization = TABLE_BTREE;
 }
 
-Pager* pager_open(const char* filename) {
+Pager* pager_open(const char* filename, DbOptions* options) {
     int fd = open(filename,
                     O_RDWR |      // Read/Write mode
                         O_CREAT,  // Create file if it does not exist
@@ -723,46 +2395,153 @@ Pager* pager_open(const char* filename) {
         cout << "Unable to open file." << endl;
         exit(EXIT_FAILURE);
     }
+    // 先用 WAL 重做已提交的语句，再读取文件长度
+    Wal* wal = NULL;
+    if (options->use_wal) {
+        wal = wal_open(filename, fd, PAGE_SIZE, options->wal_sync, options->group_commit_ms);
+    }
     off_t file_length = lseek(fd, 0, SEEK_END);
     // cout << "file_length: " << file_length << endl;
-    Pager* pager = static_cast<Pager*>(malloc(sizeof(Pager)));
+    if (file_length % PAGE_SIZE != 0) {
+        cout << "Db file is not a whole number of pages. Corrupt file." << endl;
+        exit(EXIT_FAILURE);
+    }
+    Pager* pager = new Pager();
+    pager->mode = options->mode;
     pager->file_descriptor = fd;
     pager->file_length = file_length;
     pager->num_pages = (file_length / PAGE_SIZE);
-    if (file_length % PAGE_SIZE != 0) {
-        cout << "Db file is not a whole number of pages. Corrupt file." << endl;
+    pager->num_frames = 0;
+    pager->num_used_frames = 0;
+    pager->clock_hand = 0;
+    pager->wal = wal;
+    pager->map = NULL;
+    pager->map_length = 0;
+    pager->readahead_pages = options->readahead_pages;
+    pager->io = NULL;
+    pager->pending_reads = 0;
+    pager->pending_writes = 0;
+    pager->sync_write_backs = 0;
+
+    if (pager->mode == PAGER_MMAP) {
+        // 预留整段地址空间，之后把文件映射进去
+        void* reserved = mmap(NULL, PAGER_MMAP_RESERVE_BYTES, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserved == MAP_FAILED) {
+            cout << "Unable to reserve address space for mmap pager." << endl;
+            exit(EXIT_FAILURE);
+        }
+        pager->map = static_cast<char*>(reserved);
+        if (file_length > 0) {
+            pager_mmap_grow(pager, file_length);
+        }
+        return pager;
+    }
+
+    uint32_t num_frames = options->num_frames;
+    if (num_frames < PAGER_MIN_NUM_FRAMES) {
+        num_frames = PAGER_MIN_NUM_FRAMES;
+    }
+    pager->num_frames = num_frames;
+
+    // 所有帧的内存一次性分配，按页对齐
+    void* pool = NULL;
+    if (posix_memalign(&pool, PAGE_SIZE, (size_t)num_frames * PAGE_SIZE) != 0) {
+        cout << "Unable to allocate buffer pool of " << num_frames << " frames." << endl;
         exit(EXIT_FAILURE);
     }
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+    pager->frames = new Frame[num_frames];
+    for (uint32_t i = 0; i < num_frames; i++) {
+        pager->frames[i].data = (char*)pool + (size_t)i * PAGE_SIZE;
+        pager->frames[i].page_num = INVALID_PAGE_NUM;
+        pager->frames[i].pin_count = 0;
+        pager->frames[i].referenced = false;
+        pager->frames[i].dirty = false;
+        pager->frames[i].in_txn = false;
+        pager->frames[i].io_pending = false;
+        pager->frames[i].io_sync = false;
     }
+    pager->page_table.reserve(num_frames);
+    pager->io = page_io_open(PAGE_IO_QUEUE_DEPTH, options->use_uring);
     return pager;
 }
 
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
-    Table* table = (Table*)malloc(sizeof(Table));
+Table* db_open(const char* filename, DbOptions* options) {
+    Pager* pager = pager_open(filename, options);
+    Table* table = new Table();
     table->pager = pager;
-    table->root_page_num = 0;
+    table->internal_node_max_cells = INTERNAL_NODE_MAX_CELLS;
+    if (options->internal_node_max_cells != 0) {
+        table->internal_node_max_cells = min(max(options->internal_node_max_cells,
+                                                 INTERNAL_NODE_MIN_MAX_CELLS),
+                                             INTERNAL_NODE_MAX_CELLS);
+    }
     if (pager->num_pages == 0) {
-        // New database file. Initialize page 0 as leaf node.
-        void* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+        // New database file. Page 0 is the header, the root starts as a leaf.
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_magic(header) = DB_HEADER_MAGIC;
+        *db_header_version(header) = DB_FORMAT_VERSION;
+        *db_header_freelist_trunk(header) = 0;
+        *db_header_freelist_count(header) = 0;
+        for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+            *db_header_index_root(header, (IndexColumn)column) = 0;
+        }
+        *db_header_organization(header) = options->organization;
+        pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+
+        uint32_t root_page_num;
+        if (options->organization == TABLE_HASH) {
+            root_page_num = hash_create(pager);
+        } else {
+            root_page_num = get_unused_page_num(pager);
+            void* root_node = get_page(pager, root_page_num);
+            initialize_leaf_node(root_node);
+            set_node_root(root_node, true);
+            pager_mark_dirty(pager, root_page_num);
+            pager_unpin(pager, root_page_num);
+        }
+        *db_header_root_page(header) = root_page_num;
+        pager_unpin(pager, DB_HEADER_PAGE_NUM);
+        pager_commit(pager);
+    }
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (*db_header_magic(header) != DB_HEADER_MAGIC) {
+        cout << "Db file has no valid header page. Unsupported file format." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (*db_header_version(header) != DB_FORMAT_VERSION) {
+        cout << "Db file format version " << *db_header_version(header)
+             << " is not supported (expected " << DB_FORMAT_VERSION << ")." << endl;
+        exit(EXIT_FAILURE);
+    }
+    table->root_page_num = *db_header_root_page(header);
+    table->organization = (TableOrganization)*db_header_organization(header);
+    if (table->organization == TABLE_HASH) {
+        table->hash = hash_open(pager, table->root_page_num);
+    } else if (table->organization != TABLE_BTREE) {
+        cout << "Db file has unknown table organization " << table->organization << ". Corrupt file." << endl;
+        exit(EXIT_FAILURE);
     }
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        uint32_t index_root = *db_header_index_root(header, (IndexColumn)column);
+        table->indexes[column] = index_root == 0 ? NULL : tree_open(table, index_root);
+    }
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
     return table;
 }
 
 void db_close(Table* table) {
     Pager* pager = table->pager;
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-        // print_page(pager, 0);
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+    pager_commit(pager);
+    pager_checkpoint(pager);
+    pager_wait_io(pager);
+    if (pager->wal) {
+        wal_close(pager->wal);
+    }
+    if (pager->mode == PAGER_MMAP) {
+        munmap(pager->map, PAGER_MMAP_RESERVE_BYTES);
+        // 去掉按块增长时多出来的空页
+        ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE);
     }
 
     int result = close(pager->file_descriptor);
@@ -770,41 +2549,90 @@ void db_close(Table* table) {
         cout << "Error closing db file.\n";
         exit(EXIT_FAILURE);
     }
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
-        }
+    if (pager->mode == PAGER_BUFFERED) {
+        page_io_close(pager->io);
+        free(pager->frames[0].data);
+        delete[] pager->frames;
+    }
+    delete pager;
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        delete table->indexes[column].load();
     }
-    free(pager);
-    free(table);
+    delete table->hash;
+    delete table;
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        cout << "Tried to flush null page" << endl;
-        exit(EXIT_FAILURE);
+/*
+Write every dirty frame back. Dirty page numbers are sorted so that
+runs of adjacent pages go out as a single vectored write, and all
+runs are submitted to pager->io as one batch. Write-backs that
+get_page has going outside the lock are waited for as well, since a
+checkpoint is about to make the file durable.
+*/
+void pager_flush_all(Pager* pager) {
+    if (pager->wal) {
+        wal_sync(pager->wal);
     }
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        cout << "Error seeking: " << errno << endl;
-        exit(EXIT_FAILURE);
+    unique_lock<shared_mutex> lock(pager->mutex);
+    if (pager->mode == PAGER_MMAP) {
+        if (pager->map_length > 0 && msync(pager->map, pager->map_length, MS_SYNC) == -1) {
+            cout << "Error syncing mapping: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        pager->stats.write_calls += 1;
+        return;
     }
-    // cout << "page_num: " << page_num << endl;
-    // print_page(pager, page_num);
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        cout << "Error writing: " << errno << endl;
-        exit(EXIT_FAILURE);
+    while (pager->sync_write_backs > 0) {
+        pager->io_done.wait(lock);
+    }
+    vector<pair<uint32_t, uint32_t>> dirty_pages;  // (page_num, frame index)
+    for (uint32_t i = 0; i < pager->num_used_frames; i++) {
+        Frame* frame = &pager->frames[i];
+        if (frame->page_num != INVALID_PAGE_NUM && frame->dirty) {
+            dirty_pages.push_back(make_pair(frame->page_num, i));
+        }
+    }
+    sort(dirty_pages.begin(), dirty_pages.end());
+
+    vector<struct iovec> iov(dirty_pages.size());
+    size_t run_start = 0;
+    while (run_start < dirty_pages.size()) {
+        size_t run_end = run_start + 1;
+        while (run_end < dirty_pages.size() && run_end - run_start < IOV_MAX &&
+               dirty_pages[run_end].first == dirty_pages[run_end - 1].first + 1) {
+            run_end++;
+        }
+        uint32_t run_length = run_end - run_start;
+        for (uint32_t i = 0; i < run_length; i++) {
+            iov[run_start + i].iov_base = pager->frames[dirty_pages[run_start + i].second].data;
+            iov[run_start + i].iov_len = PAGE_SIZE;
+        }
+        while (page_io_free_slots(pager->io) == 0) {
+            pager_reap_io(pager, true);
+        }
+        off_t offset = (off_t)dirty_pages[run_start].first * PAGE_SIZE;
+        page_io_queue(pager->io, PAGE_IO_WRITE, pager->file_descriptor, &iov[run_start],
+                      run_length, offset, PAGER_IO_WRITE_TAG | run_length);
+        pager->pending_writes += 1;
+        for (uint32_t i = 0; i < run_length; i++) {
+            pager->frames[dirty_pages[run_start + i].second].dirty = false;
+        }
+        pager->stats.pages_written += run_length;
+        pager->stats.write_calls += 1;
+        if (offset + (off_t)run_length * PAGE_SIZE > pager->file_length) {
+            pager->file_length = offset + (off_t)run_length * PAGE_SIZE;
+        }
+        run_start = run_end;
+    }
+    page_io_submit(pager->io);
+    while (pager->pending_writes > 0) {
+        pager_reap_io(pager, true);
     }
 }
 
 Cursor* table_start(Table* table) {
     Cursor* cursor = table_find(table, 0);
-    void* node = get_page(table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    cursor->end_of_table = (num_cells == 0);
+    cursor_settle(cursor);
     return cursor;
 }
 
@@ -815,14 +2643,137 @@ uint32_t* leaf_node_next_leaf(void* node) {
 uint32_t* leaf_node_num_cells(void* node) {
     return (uint32_t*)(((char*)node + LEAF_NODE_NUM_CELLS_OFFSET));
 }
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-    return (void*)((char*)node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE);
-}
 uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-    return static_cast<uint32_t*>(leaf_node_cell(node, cell_num));
+    return (uint32_t*)((char*)node + LEAF_NODE_KEYS_OFFSET + cell_num * LEAF_NODE_KEY_SIZE);
+}
+uint16_t* leaf_node_heap_start(void* node) {
+    return (uint16_t*)((char*)node + LEAF_NODE_HEAP_START_OFFSET);
+}
+/* The slot array starts right after the last key, so it moves with num_cells */
+uint16_t* leaf_node_slot(void* node, uint32_t cell_num) {
+    return (uint16_t*)((char*)node + LEAF_NODE_KEYS_OFFSET + *leaf_node_num_cells(node) * LEAF_NODE_KEY_SIZE +
+                       cell_num * LEAF_NODE_SLOT_SIZE);
 }
 void* leaf_node_value(void* node, uint32_t cell_num) {
-    return (void*)((char*)leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE);
+    return (void*)((char*)node + *leaf_node_slot(node, cell_num));
+}
+/* A stored row starts with its two string lengths */
+uint32_t leaf_node_value_size(void* node, uint32_t cell_num) {
+    uint8_t* value = static_cast<uint8_t*>(leaf_node_value(node, cell_num));
+    return ROW_LENGTHS_SIZE + value[0] + value[1];
+}
+
+/* Bytes taken by live cells: keys, slots and rows, not counting holes */
+uint32_t leaf_node_used_space(void* node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t used = num_cells * LEAF_NODE_CELL_OVERHEAD;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        used += leaf_node_value_size(node, i);
+    }
+    return used;
+}
+
+/* Rewrite the rows back to back at the end of the page, in cell order */
+void leaf_node_compact(void* node) {
+    char copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t heap_start = PAGE_SIZE - (leaf_node_used_space(node) - num_cells * LEAF_NODE_CELL_OVERHEAD);
+    *leaf_node_heap_start(node) = heap_start;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint32_t size = leaf_node_value_size(copy, i);
+        memcpy((char*)node + heap_start, leaf_node_value(copy, i), size);
+        *leaf_node_slot(node, i) = heap_start;
+        heap_start += size;
+    }
+}
+
+/*
+Insert a cell before cell_num. The row goes into the gap between the
+slot array and the heap, after squeezing out holes if the gap is too
+small. Returns false, leaving the node as it was, if it does not fit.
+*/
+bool leaf_node_insert_cell(void* node, uint32_t cell_num, uint32_t key, const void* value, uint32_t size) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t heap_start = *leaf_node_heap_start(node);
+    uint32_t cells_end = LEAF_NODE_KEYS_OFFSET + num_cells * LEAF_NODE_CELL_OVERHEAD;
+    if (cells_end + LEAF_NODE_CELL_OVERHEAD + size > heap_start) {
+        if (leaf_node_used_space(node) + LEAF_NODE_CELL_OVERHEAD + size > LEAF_NODE_SPACE_FOR_CELLS) {
+            return false;
+        }
+        leaf_node_compact(node);
+        heap_start = *leaf_node_heap_start(node);
+    }
+    // 槽数组整体后移一个 key 的位置，同时在 cell_num 处空出一个槽
+    char* slots = (char*)leaf_node_slot(node, 0);
+    memmove(slots + LEAF_NODE_KEY_SIZE + (cell_num + 1) * LEAF_NODE_SLOT_SIZE,
+            slots + cell_num * LEAF_NODE_SLOT_SIZE, (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+    memmove(slots + LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(leaf_node_key(node, cell_num + 1), leaf_node_key(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+    heap_start -= size;
+    memcpy((char*)node + heap_start, value, size);
+    *leaf_node_heap_start(node) = heap_start;
+    *leaf_node_num_cells(node) = num_cells + 1;
+    *leaf_node_key(node, cell_num) = key;
+    *leaf_node_slot(node, cell_num) = heap_start;
+    return true;
+}
+
+/*
+Replace the row of cell_num. A row no longer than the old one is
+written over it; a longer one moves to the free gap like a new row.
+Returns false, leaving the node as it was, if it does not fit.
+*/
+bool leaf_node_update_cell(void* node, uint32_t cell_num, const void* value, uint32_t size) {
+    uint32_t old_size = leaf_node_value_size(node, cell_num);
+    if (size <= old_size) {
+        memcpy(leaf_node_value(node, cell_num), value, size);
+        return true;
+    }
+    if (leaf_node_used_space(node) - old_size + size > LEAF_NODE_SPACE_FOR_CELLS) {
+        return false;
+    }
+    // 旧行留作空洞，插入时空间不够会先整理
+    uint32_t key = *leaf_node_key(node, cell_num);
+    leaf_node_remove_cell(node, cell_num);
+    leaf_node_insert_cell(node, cell_num, key, value, size);
+    return true;
+}
+
+/* Remove a cell; its row stays behind as a hole until the next compaction */
+void leaf_node_remove_cell(void* node, uint32_t cell_num) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    char* slots = (char*)leaf_node_slot(node, 0);
+    memmove(leaf_node_key(node, cell_num), leaf_node_key(node, cell_num + 1),
+            (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_SLOT_SIZE, slots + (cell_num + 1) * LEAF_NODE_SLOT_SIZE,
+            (num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+    *leaf_node_num_cells(node) = num_cells - 1;
+    if (num_cells == 1) {
+        *leaf_node_heap_start(node) = PAGE_SIZE;
+    }
+}
+
+/*
+Move count cells from source to destination, which must be different
+nodes and have room for the rows.
+*/
+void leaf_node_move_cells(void* destination, uint32_t destination_cell,
+                          void* source, uint32_t source_cell, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        leaf_node_insert_cell(destination, destination_cell + i, *leaf_node_key(source, source_cell + i),
+                              leaf_node_value(source, source_cell + i), leaf_node_value_size(source, source_cell + i));
+    }
+    if (source_cell == 0 && count == *leaf_node_num_cells(source)) {
+        *leaf_node_num_cells(source) = 0;
+        *leaf_node_heap_start(source) = PAGE_SIZE;
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        leaf_node_remove_cell(source, source_cell);
+    }
 }
 
 void initialize_leaf_node(void* node) {
@@ -830,6 +2781,7 @@ void initialize_leaf_node(void* node) {
     set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
     *leaf_node_next_leaf(node) = 0;  // 0 represents no sibling
+    *leaf_node_heap_start(node) = PAGE_SIZE;
 }
 
 void initialize_internal_node(void* node) {
@@ -844,33 +2796,45 @@ void initialize_internal_node(void* node) {
     *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
 
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
+/* Insert an encoded record (a row, or an index list) at the cursor */
+void leaf_node_insert(Cursor* cursor, uint32_t key, const void* value, uint32_t size) {
     void* node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    if (!leaf_node_insert_cell(node, cursor->cell_num, key, value, size)) {
         // Node full
-        leaf_node_split_and_insert(cursor, key, value);
+        pager_unpin(cursor->table->pager, cursor->page_num);
+        leaf_node_split_and_insert(cursor, key, value, size);
         return;
     }
-    if (cursor->cell_num < num_cells) {
-        // Make room for new cell
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-                    LEAF_NODE_CELL_SIZE);
-        }
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+    pager_unpin(cursor->table->pager, cursor->page_num);
+}
+
+/*
+Remove the cell under the cursor, which must come from
+table_find_for_write. Returns true when the leaf still has to be
+rebalanced with btree_rebalance_leaf after the cursor is closed.
+*/
+bool leaf_node_delete(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    void* node = get_page(pager, cursor->page_num);
+    leaf_node_remove_cell(node, cursor->cell_num);
+    uint32_t used = leaf_node_used_space(node);
+    pager_mark_dirty(pager, cursor->page_num);
+    pager_unpin(pager, cursor->page_num);
+    if (cursor->depth > 0 && used < LEAF_NODE_MIN_SPACE) {
+        return btree_rebalance(cursor, cursor->depth);
     }
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    return false;
 }
 
 void print_constants() {
-    cout << "ROW_SIZE: " << ROW_SIZE << endl;
+    cout << "ROW_MAX_SIZE: " << ROW_MAX_SIZE << endl;
     cout << "COMMON_NODE_HEADER_SIZE: " << COMMON_NODE_HEADER_SIZE << endl;
     cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << endl;
-    cout << "LEAF_NODE_CELL_SIZE: " << LEAF_NODE_CELL_SIZE << endl;
+    cout << "LEAF_NODE_CELL_OVERHEAD: " << LEAF_NODE_CELL_OVERHEAD << endl;
     cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS << endl;
-    cout << "LEAF_NODE_MAX_CELLS: " << LEAF_NODE_MAX_CELLS << endl;
+    cout << "LEAF_NODE_MAX_CELL_SIZE: " << LEAF_NODE_MAX_CELL_SIZE << endl;
+    cout << "INTERNAL_NODE_MAX_CELLS: " << INTERNAL_NODE_MAX_CELLS << endl;
 }
 
 
@@ -907,66 +2871,285 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
             num_keys = *internal_node_num_keys(node);
             indent(indentation_level);
             cout << "- internal (size " << num_keys << ")\n";
-            if (num_keys > 0) {
-                for (uint32_t i = 0; i < num_keys; i++) {
-                    child = *internal_node_child(node, i);
-                    print_tree(pager, child, indentation_level + 1);
-                    indent(indentation_level + 1);
-                    cout << "- key " << *internal_node_key(node, i) << "\n";
-                }
-                child = *internal_node_right_child(node);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                child = *internal_node_child(node, i);
+                print_tree(pager, child, indentation_level + 1);
+                indent(indentation_level + 1);
+                cout << "- key " << *internal_node_key(node, i) << "\n";
+            }
+            // 追加分裂出的节点可能只有右孩子
+            child = *internal_node_right_child(node);
+            if (child != INVALID_PAGE_NUM) {
                 print_tree(pager, child, indentation_level + 1);
             }
             break;
+        case (NODE_HASH_DIRECTORY):
+            // 哈希表的元数据页，没有树可打印
+            indent(indentation_level);
+            cout << "- hash directory (not a B-tree)\n";
+            break;
     }
+    pager_unpin(pager, page_num);
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        cout << "Must supply a database filename." << endl;
-        exit(EXIT_FAILURE);
+/*
+Start a bulk load into an empty table. Returns NULL if the table
+already holds rows.
+*/
+BulkLoader* bulk_load_begin(Table* table, uint32_t fill_percent) {
+    void* root = get_page(table->pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    pager_unpin(table->pager, table->root_page_num);
+    if (!empty) {
+        return NULL;
+    }
+    fill_percent = min(max(fill_percent, 1u), 100u);
+    BulkLoader* loader = new BulkLoader();
+    loader->table = table;
+    loader->leaf_capacity = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    loader->internal_capacity = max(2u, (table->internal_node_max_cells + 1) * fill_percent / 100);
+    loader->leaf_page_num = INVALID_PAGE_NUM;
+    loader->leaf_num_cells = 0;
+    loader->leaf_used = 0;
+    loader->last_key = 0;
+    loader->num_rows = 0;
+    return loader;
+}
+
+static uint32_t bulk_load_allocate(BulkLoader* loader) {
+    uint32_t page_num = get_unused_page_num(loader->table->pager);
+    loader->pages.push_back(page_num);
+    return page_num;
+}
+
+static void bulk_load_push(BulkLoader* loader, uint32_t level, uint32_t child_page_num, uint32_t child_max);
+
+/* The open node at level is full or the load is over: hand it to the level above */
+static void bulk_load_close(BulkLoader* loader, uint32_t level) {
+    uint32_t page_num = loader->levels[level].page_num;
+    uint32_t max_key = loader->levels[level].max_key;
+    loader->levels[level].page_num = INVALID_PAGE_NUM;
+    loader->levels[level].num_children = 0;
+    bulk_load_push(loader, level + 1, page_num, max_key);
+}
+
+/*
+Append a finished child to the open node at level. The newest child
+is always the right child; the previous right child moves into the
+next cell with its max key.
+*/
+static void bulk_load_push(BulkLoader* loader, uint32_t level, uint32_t child_page_num, uint32_t child_max) {
+    Pager* pager = loader->table->pager;
+    if (level == loader->levels.size()) {
+        loader->levels.push_back({INVALID_PAGE_NUM, 0, 0});
+    }
+    if (loader->levels[level].num_children == loader->internal_capacity) {
+        bulk_load_close(loader, level);
+    }
+    BulkLoadLevel* open = &loader->levels[level];
+    if (open->page_num == INVALID_PAGE_NUM) {
+        open->page_num = bulk_load_allocate(loader);
+        void* node = get_page(pager, open->page_num);
+        initialize_internal_node(node);
+        pager_mark_dirty(pager, open->page_num);
+        pager_unpin(pager, open->page_num);
+    }
+
+    void* node = get_page(pager, open->page_num);
+    if (open->num_children > 0) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        *internal_node_num_keys(node) = num_keys + 1;
+        *internal_node_child(node, num_keys) = *internal_node_right_child(node);
+        *internal_node_key(node, num_keys) = open->max_key;
+    }
+    *internal_node_right_child(node) = child_page_num;
+    pager_mark_dirty(pager, open->page_num);
+    pager_unpin(pager, open->page_num);
+    open->num_children += 1;
+    open->max_key = child_max;
+}
+
+/*
+Append one row. Keys must arrive in strictly increasing order;
+otherwise nothing is written and the caller should abort the load.
+*/
+ExecuteResult bulk_load_add(BulkLoader* loader, uint32_t key, Row* row) {
+    Pager* pager = loader->table->pager;
+    if (loader->num_rows > 0 && key <= loader->last_key) {
+        return key == loader->last_key ? EXECUTE_DUPLICATE_KEY : EXECUTE_UNSORTED_KEY;
+    }
+    char record[ROW_MAX_SIZE];
+    uint32_t size = serialize_row(row, record);
+    if (loader->leaf_page_num == INVALID_PAGE_NUM ||
+        (loader->leaf_num_cells > 0 && loader->leaf_used + LEAF_NODE_CELL_OVERHEAD + size > loader->leaf_capacity)) {
+        uint32_t new_page_num = bulk_load_allocate(loader);
+        void* new_leaf = get_page(pager, new_page_num);
+        initialize_leaf_node(new_leaf);
+        pager_mark_dirty(pager, new_page_num);
+        pager_unpin(pager, new_page_num);
+        if (loader->leaf_page_num != INVALID_PAGE_NUM) {
+            void* leaf = get_page(pager, loader->leaf_page_num);
+            *leaf_node_next_leaf(leaf) = new_page_num;
+            pager_mark_dirty(pager, loader->leaf_page_num);
+            pager_unpin(pager, loader->leaf_page_num);
+            bulk_load_push(loader, 0, loader->leaf_page_num, loader->last_key);
+        }
+        loader->leaf_page_num = new_page_num;
+        loader->leaf_num_cells = 0;
+        loader->leaf_used = 0;
     }
 
-    char* filename = argv[1];
+    void* leaf = get_page(pager, loader->leaf_page_num);
+    leaf_node_insert_cell(leaf, loader->leaf_num_cells, key, record, size);
+    loader->leaf_num_cells += 1;
+    loader->leaf_used += LEAF_NODE_CELL_OVERHEAD + size;
+    pager_mark_dirty(pager, loader->leaf_page_num);
+    pager_unpin(pager, loader->leaf_page_num);
+    loader->last_key = key;
+    loader->num_rows += 1;
+    pager_commit_partial(pager, BULK_LOAD_COMMIT_PAGES);
+    return EXECUTE_SUCCESS;
+}
 
-    Table* table = db_open(filename);
-    string input_buffer;
+/*
+Close every open node bottom-up, drop internal nodes left with a
+single child at the top, and make what remains the table's root.
+*/
+void bulk_load_finish(BulkLoader* loader) {
+    Table* table = loader->table;
+    Pager* pager = table->pager;
+    if (loader->num_rows == 0) {
+        delete loader;
+        return;
+    }
+    bulk_load_push(loader, 0, loader->leaf_page_num, loader->last_key);
+    for (uint32_t level = 0; level + 1 < loader->levels.size(); level++) {
+        bulk_load_close(loader, level);
+    }
 
+    uint32_t root_page_num = loader->levels.back().page_num;
     while (true) {
-        print_prompt();
-        getline(cin, input_buffer);
-        if (!input_buffer.empty() && input_buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
-                case (META_COMMAND_SUCCESS):
-                    continue;
-                case (META_COMMAND_UNRECOGNIZED_COMMAND):
-                    cout << "Unrecognized command '" << input_buffer << "'." << endl;
-                    continue;
-            }
+        void* root = get_page(pager, root_page_num);
+        if (get_node_type(root) != NODE_INTERNAL || *internal_node_num_keys(root) > 0) {
+            set_node_root(root, true);
+            pager_mark_dirty(pager, root_page_num);
+            pager_unpin(pager, root_page_num);
+            break;
         }
-        Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-            case (PREPARE_SUCCESS):
-                break;
-            case (PREPARE_SYNTAX_ERROR):
-                continue;
-            case (PREPARE_STRING_TOO_LONG):
-                cout << "String is too long." << endl;
-                continue;
-            case (PREPARE_UNRECOGNIZED_STATEMENT):
-                cout << "Unrecognized keyword at start of '" << input_buffer << "'." << endl;
+        uint32_t only_child = *internal_node_right_child(root);
+        pager_unpin(pager, root_page_num);
+        free_page(pager, root_page_num);
+        root_page_num = only_child;
+    }
+
+    // 换根之前就把新树的行加进索引：中途崩溃只会在索引里留下多余的 id，查询时会被核对掉
+    Table* loaded = tree_open(table, root_page_num);
+    for (uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++) {
+        Table* index = table->indexes[column];
+        if (index != NULL) {
+            index_build(loaded, index, (IndexColumn)column);
+        }
+    }
+    delete loaded;
+
+    // 换根时锁住旧根：读者要么已经读完它，要么在锁住后发现根已经换了
+    uint32_t old_root_page_num = table->root_page_num;
+    get_page(pager, old_root_page_num);
+    pager_latch(pager, old_root_page_num, LATCH_EXCLUSIVE);
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    *db_header_root_page(header) = root_page_num;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    pager_unpin(pager, DB_HEADER_PAGE_NUM);
+    table->root_page_num = root_page_num;
+    free_page(pager, old_root_page_num);
+    pager_unlatch(pager, old_root_page_num, LATCH_EXCLUSIVE);
+    pager_unpin(pager, old_root_page_num);
+    pager_commit(pager);
+    delete loader;
+}
+
+/* Give back every page the load allocated; the table is left as it was */
+void bulk_load_abort(BulkLoader* loader) {
+    for (uint32_t page_num : loader->pages) {
+        free_page(loader->table->pager, page_num);
+    }
+    pager_commit(loader->table->pager);
+    delete loader;
+}
+
+/*
+Load "id username email" lines from path, sorted by id. The whole file
+is loaded or, on the first bad line, nothing at all; the error is
+reported here and the offending line number is left in num_rows.
+*/
+ExecuteResult bulk_load_file(Table* table, const char* path, uint32_t fill_percent, uint64_t* num_rows) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        cout << "Could not open '" << path << "'." << endl;
+        return EXECUTE_UNKNOWN_COMMAND;
+    }
+    if (table->organization == TABLE_HASH) {
+        cout << "Bulk load needs a B-tree table." << endl;
+        return EXECUTE_UNKNOWN_COMMAND;
+    }
+    lock_guard<mutex> writer_lock(table->writer_mutex);
+    BulkLoader* loader = bulk_load_begin(table, fill_percent);
+    if (loader == NULL) {
+        cout << "Bulk load needs an empty table." << endl;
+        return EXECUTE_TABLE_FULL;
+    }
+    string line;
+    uint64_t line_num = 0;
+    Row row;
+    while (getline(in, line)) {
+        line_num++;
+        // Windows 换行留下的 \r 不算进 email
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        // 手工切分，比 istringstream 快得多
+        size_t id_end = line.find(' ');
+        size_t username_end = id_end == string::npos ? string::npos : line.find(' ', id_end + 1);
+        if (username_end == string::npos) {
+            if (trim(line).empty()) {
                 continue;
+            }
+            cout << "Syntax error on line " << line_num << " of '" << path << "'." << endl;
+            bulk_load_abort(loader);
+            return EXECUTE_UNKNOWN_COMMAND;
         }
-        switch (execute_statement(&statement, table)) {
-            case (EXECUTE_SUCCESS):
-                cout << "Executed." << endl; 
-                break;
-            case (EXECUTE_DUPLICATE_KEY):
-                cout << "Error: Duplicate key." << endl;
-                break;
-            case (EXECUTE_TABLE_FULL):
-                cout << "Error: Table full." << endl;
-                break;
+        size_t username_length = username_end - id_end - 1;
+        size_t email_length = line.size() - username_end - 1;
+        if (username_length > COLUMN_USERNAME_SIZE || email_length > COLUMN_EMAIL_SIZE) {
+            cout << "String is too long on line " << line_num << " of '" << path << "'." << endl;
+            bulk_load_abort(loader);
+            return EXECUTE_UNKNOWN_COMMAND;
+        }
+        // id 必须是一个 uint32_t 范围内的十进制数，后面紧跟空格
+        const char* id_text = line.c_str();
+        char* id_text_end;
+        errno = 0;
+        unsigned long id = strtoul(id_text, &id_text_end, 10);
+        if (!isdigit((unsigned char)id_text[0]) || errno == ERANGE || id > UINT32_MAX ||
+            id_text_end != id_text + id_end) {
+            cout << "Invalid id on line " << line_num << " of '" << path << "'." << endl;
+            bulk_load_abort(loader);
+            return EXECUTE_UNKNOWN_COMMAND;
+        }
+        row.id = (uint32_t)id;
+        memcpy(row.username, line.c_str() + id_end + 1, username_length);
+        row.username[username_length] = '\0';
+        memcpy(row.email, line.c_str() + username_end + 1, email_length);
+        row.email[email_length] = '\0';
+
+        ExecuteResult result = bulk_load_add(loader, row.id, &row);
+        if (result != EXECUTE_SUCCESS) {
+            bulk_load_abort(loader);
+            *num_rows = line_num;
+            return result;
         }
     }
-}
\ No newline at end of file
+    *num_rows = loader->num_rows;
+    bulk_load_finish(loader);
+    return EXECUTE_SUCCESS;
+}
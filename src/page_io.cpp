@@ -0,0 +1,203 @@
+#include "page_io.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+/*
+No liburing: the three io_uring system calls are issued directly
+and the rings are driven with the acquire/release protocol from
+the io_uring documentation.
+*/
+static int io_uring_setup(uint32_t entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static bool page_io_setup_uring(PageIo* io) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = io_uring_setup(io->depth, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SUBMIT_STABLE)) {
+        close(ring_fd);
+        return false;
+    }
+    io->ring_fd = ring_fd;
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        if (io->sq_ring != MAP_FAILED) munmap(io->sq_ring, io->sq_ring_size);
+        if (io->cq_ring != MAP_FAILED) munmap(io->cq_ring, io->cq_ring_size);
+        if (sqes != MAP_FAILED) munmap(sqes, io->sqes_size);
+        close(ring_fd);
+        return false;
+    }
+    io->sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(io->sq_ring);
+    io->sq_head = (uint32_t*)(sq + params.sq_off.head);
+    io->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    io->sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    io->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(io->cq_ring);
+    io->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    io->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    io->cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    // 内核可能把深度向上取整
+    io->depth = params.sq_entries;
+    return true;
+}
+
+PageIo* page_io_open(uint32_t depth, bool try_uring) {
+    PageIo* io = new PageIo();
+    io->depth = depth;
+    io->queued = 0;
+    io->in_flight = 0;
+    io->ring_fd = -1;
+    io->stats = {};
+    io->uring = try_uring && page_io_setup_uring(io);
+    return io;
+}
+
+void page_io_close(PageIo* io) {
+    if (io->uring) {
+        munmap(io->sqes, io->sqes_size);
+        munmap(io->cq_ring, io->cq_ring_size);
+        munmap(io->sq_ring, io->sq_ring_size);
+        close(io->ring_fd);
+    }
+    delete io;
+}
+
+/* Requests that can still be queued before something must be reaped */
+uint32_t page_io_free_slots(PageIo* io) {
+    return io->depth - io->queued - io->in_flight;
+}
+
+/*
+Queue one vectored read or write. The caller checks
+page_io_free_slots first and calls page_io_submit before iov goes away.
+*/
+void page_io_queue(PageIo* io, PageIoOp op, int fd, const struct iovec* iov, int iovcnt,
+                   off_t offset, uint64_t user_data) {
+    if (page_io_free_slots(io) == 0) {
+        cout << "Page I/O queue is full." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (op == PAGE_IO_READ) {
+        io->stats.reads += 1;
+    } else {
+        io->stats.writes += 1;
+    }
+
+    if (!io->uring) {
+        ssize_t result = (op == PAGE_IO_READ) ? preadv(fd, iov, iovcnt, offset)
+                                              : pwritev(fd, iov, iovcnt, offset);
+        PageIoCompletion completion;
+        completion.user_data = user_data;
+        completion.result = result < 0 ? -errno : (int32_t)result;
+        io->completed.push_back(completion);
+        io->stats.submits += 1;
+        io->in_flight += 1;
+        return;
+    }
+
+    uint32_t tail = *io->sq_tail;
+    uint32_t index = tail & *io->sq_mask;
+    struct io_uring_sqe* sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (op == PAGE_IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    io->sq_array[index] = index;
+    // 先写好 SQE，再让内核看到新的 tail
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->queued += 1;
+}
+
+/* Hand every queued request to the kernel without waiting for any */
+void page_io_submit(PageIo* io) {
+    if (!io->uring || io->queued == 0) {
+        return;
+    }
+    int submitted;
+    do {
+        submitted = io_uring_enter(io->ring_fd, io->queued, 0, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted < 0) {
+        cout << "Error submitting page I/O: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    io->queued -= submitted;
+    io->in_flight += submitted;
+    io->stats.submits += 1;
+}
+
+/*
+Take one completion. With wait set, blocks until a submitted request
+finishes; returns false when nothing is (or, without wait, nothing
+has yet) completed.
+*/
+bool page_io_reap(PageIo* io, PageIoCompletion* completion, bool wait) {
+    if (!io->uring) {
+        if (io->completed.empty()) {
+            return false;
+        }
+        *completion = io->completed.front();
+        io->completed.pop_front();
+        io->in_flight -= 1;
+        return true;
+    }
+
+    if (wait && io->queued > 0) {
+        page_io_submit(io);
+    }
+    while (true) {
+        uint32_t head = *io->cq_head;
+        if (head != __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &io->cqes[head & *io->cq_mask];
+            completion->user_data = cqe->user_data;
+            completion->result = cqe->res;
+            __atomic_store_n(io->cq_head, head + 1, __ATOMIC_RELEASE);
+            io->in_flight -= 1;
+            return true;
+        }
+        if (!wait || io->in_flight == 0) {
+            return false;
+        }
+        if (io_uring_enter(io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            cout << "Error waiting for page I/O: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void print_page_io_stats(PageIo* io) {
+    cout << "io_mode: " << (io->uring ? "io_uring" : "sync") << "\n";
+    cout << "io_submits: " << io->stats.submits << "\n";
+    cout << "io_reads: " << io->stats.reads << "\n";
+    cout << "io_writes: " << io->stats.writes << endl;
+}
@@ -1,4 +1,577 @@
-#include "parser.h"
+#include "mydb.h"
 
 using namespace std;
 
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool is_identifier_char(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+void lexer_init(Lexer* lexer, string_view input) {
+    lexer->input = input;
+    lexer->pos = 0;
+}
+
+static void lexer_skip_space(Lexer* lexer) {
+    while (lexer->pos < lexer->input.size() && is_space(lexer->input[lexer->pos])) {
+        lexer->pos++;
+    }
+}
+
+Token lexer_next(Lexer* lexer) {
+    lexer_skip_space(lexer);
+    string_view input = lexer->input;
+    size_t start = lexer->pos;
+    Token token;
+    if (start == input.size()) {
+        token.type = TOKEN_END;
+        token.text = input.substr(start, 0);
+        return token;
+    }
+
+    char c = input[start];
+    size_t end = start + 1;
+    if (is_digit(c)) {
+        // "12ab" 切成 12 和 ab，由语法去报错
+        while (end < input.size() && is_digit(input[end])) {
+            end++;
+        }
+        token.type = TOKEN_NUMBER;
+    } else if (is_identifier_char(c)) {
+        while (end < input.size() && is_identifier_char(input[end])) {
+            end++;
+        }
+        token.type = TOKEN_IDENTIFIER;
+    } else {
+        bool equal_follows = end < input.size() && input[end] == '=';
+        switch (c) {
+            case '(': token.type = TOKEN_LEFT_PAREN; break;
+            case ')': token.type = TOKEN_RIGHT_PAREN; break;
+            case ',': token.type = TOKEN_COMMA; break;
+            case ';': token.type = TOKEN_SEMICOLON; break;
+            case '=': token.type = TOKEN_EQUAL; break;
+            case '?': token.type = TOKEN_PARAMETER; break;
+            case '<':
+                token.type = equal_follows ? TOKEN_LESS_EQUAL : TOKEN_LESS;
+                end += equal_follows;
+                break;
+            case '>':
+                token.type = equal_follows ? TOKEN_GREATER_EQUAL : TOKEN_GREATER;
+                end += equal_follows;
+                break;
+            default: token.type = TOKEN_OTHER; break;
+        }
+    }
+    lexer->pos = end;
+    token.text = input.substr(start, end - start);
+    return token;
+}
+
+string_view lexer_next_word(Lexer* lexer) {
+    lexer_skip_space(lexer);
+    size_t start = lexer->pos;
+    while (lexer->pos < lexer->input.size() && !is_space(lexer->input[lexer->pos])) {
+        lexer->pos++;
+    }
+    return lexer->input.substr(start, lexer->pos - start);
+}
+
+/* The lexer plus one token of lookahead */
+typedef struct {
+    Lexer lexer;
+    Token current;
+    PreparedStatement* prepared;    // 解析 prepared statement 时非空，'?' 才算参数
+} Parser;
+
+static void parser_advance(Parser* parser) {
+    parser->current = lexer_next(&parser->lexer);
+}
+
+static bool parser_accept(Parser* parser, TokenType type) {
+    if (parser->current.type != type) {
+        return false;
+    }
+    parser_advance(parser);
+    return true;
+}
+
+static bool parser_accept_keyword(Parser* parser, string_view keyword) {
+    if (parser->current.type != TOKEN_IDENTIFIER || parser->current.text != keyword) {
+        return false;
+    }
+    parser_advance(parser);
+    return true;
+}
+
+/*
+Take a raw word starting at the lookahead token. The lookahead was cut
+by the token rules, so rewind the lexer to its first character and
+read up to the next whitespace instead.
+*/
+static bool parser_word(Parser* parser, string_view* word) {
+    if (parser->current.type == TOKEN_END) {
+        return false;
+    }
+    parser->lexer.pos = parser->current.text.data() - parser->lexer.input.data();
+    *word = lexer_next_word(&parser->lexer);
+    parser_advance(parser);
+    return true;
+}
+
+// 只接受十进制数字，19 位以内的数放得进 uint64
+static bool parse_number(string_view text, uint64_t max_value, uint64_t* value) {
+    if (text.empty() || text.size() > 19) {
+        return false;
+    }
+    uint64_t result = 0;
+    for (char c : text) {
+        if (!is_digit(c)) {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    if (result > max_value) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+static bool parser_id(Parser* parser, uint32_t* id) {
+    uint64_t value;
+    if (parser->current.type != TOKEN_NUMBER || !parse_number(parser->current.text, UINT32_MAX, &value)) {
+        return false;
+    }
+    *id = (uint32_t)value;
+    parser_advance(parser);
+    return true;
+}
+
+static void parser_add_parameter(Parser* parser, ParamTarget target, TokenType op) {
+    PreparedParam param;
+    param.target = target;
+    param.op = op;
+    param.value = 0;
+    parser->prepared->params.push_back(param);
+}
+
+/* A '?' where an id or number goes, when parsing a prepared statement */
+static bool parser_parameter(Parser* parser, ParamTarget target, TokenType op = TOKEN_END) {
+    if (parser->prepared == NULL || parser->current.type != TOKEN_PARAMETER) {
+        return false;
+    }
+    parser_add_parameter(parser, target, op);
+    parser_advance(parser);
+    return true;
+}
+
+/*
+A raw word, or a '?' standing alone in a prepared statement, which
+leaves the word empty until it is bound. Outside prepared statements
+"?" is an ordinary value.
+*/
+static bool parser_word_or_parameter(Parser* parser, ParamTarget target, string_view* word) {
+    if (!parser_word(parser, word)) {
+        return false;
+    }
+    if (parser->prepared != NULL && *word == "?") {
+        parser_add_parameter(parser, target, TOKEN_END);
+        *word = word->substr(0, 0);
+    }
+    return true;
+}
+
+static bool parser_end(Parser* parser) {
+    parser_accept(parser, TOKEN_SEMICOLON);
+    return parser->current.type == TOKEN_END;
+}
+
+static PrepareResult syntax_error() {
+    cout << "Syntax error. Could not parse statement." << endl;
+    return PREPARE_SYNTAX_ERROR;
+}
+
+static PrepareResult parse_insert(Parser* parser, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    Row* row = &statement->row_to_insert;
+    string_view username;
+    string_view email;
+    // email 是原样的一个词，行尾的 ';' 也算在里面，所以这里不调 parser_end
+    bool id_parsed = parser_id(parser, &row->id);
+    if (!id_parsed && parser_parameter(parser, PARAM_INSERT_ID)) {
+        // 没绑定过的 id 是 0，和没绑定的字符串是空串一样
+        row->id = 0;
+        id_parsed = true;
+    }
+    if (!id_parsed || !parser_word_or_parameter(parser, PARAM_INSERT_USERNAME, &username) ||
+        !parser_word_or_parameter(parser, PARAM_INSERT_EMAIL, &email) || parser->current.type != TOKEN_END) {
+        return syntax_error();
+    }
+    if (username.size() > COLUMN_USERNAME_SIZE || email.size() > COLUMN_EMAIL_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(row->username, username.data(), username.size());
+    row->username[username.size()] = '\0';
+    memcpy(row->email, email.data(), email.size());
+    row->email[email.size()] = '\0';
+    return PREPARE_SUCCESS;
+}
+
+/* Narrow the statement's id range by "id <op> <value>" */
+static bool apply_id_condition(TokenType op, uint32_t value, Statement* statement) {
+    bool empty = false;
+    switch (op) {
+        case TOKEN_EQUAL:
+            statement->range_start = max(statement->range_start, value);
+            statement->range_end = min(statement->range_end, value);
+            break;
+        case TOKEN_GREATER_EQUAL:
+            statement->range_start = max(statement->range_start, value);
+            break;
+        case TOKEN_GREATER:
+            empty = value == UINT32_MAX;
+            statement->range_start = max(statement->range_start, value + 1);
+            break;
+        case TOKEN_LESS_EQUAL:
+            statement->range_end = min(statement->range_end, value);
+            break;
+        case TOKEN_LESS:
+            empty = value == 0;
+            statement->range_end = min(statement->range_end, value - 1);
+            break;
+        default:
+            return false;
+    }
+    if (empty) {
+        statement->range_start = 1;
+        statement->range_end = 0;
+    }
+    return true;
+}
+
+static bool parse_index_column(string_view name, IndexColumn* column) {
+    if (name == "username") {
+        *column = INDEX_COLUMN_USERNAME;
+    } else if (name == "email") {
+        *column = INDEX_COLUMN_EMAIL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+Parse one where condition. Each "id <op> <value>" narrows the
+statement's id range; at most one "username = <value>" or
+"email = <value>" may be given as well.
+*/
+static bool parse_condition(Parser* parser, Statement* statement) {
+    if (parser_accept_keyword(parser, "id")) {
+        TokenType op = parser->current.type;
+        parser_advance(parser);
+        if (parser_parameter(parser, PARAM_ID_CONDITION, op)) {
+            // 比较符在 TOKEN_EQUAL 到 TOKEN_GREATER_EQUAL 之间
+            return op >= TOKEN_EQUAL && op <= TOKEN_GREATER_EQUAL;
+        }
+        uint32_t value;
+        return parser_id(parser, &value) && apply_id_condition(op, value, statement);
+    }
+    IndexColumn column;
+    if (parser->current.type != TOKEN_IDENTIFIER || !parse_index_column(parser->current.text, &column) ||
+        statement->has_column_value) {
+        return false;
+    }
+    parser_advance(parser);
+    string_view value;
+    if (!parser_accept(parser, TOKEN_EQUAL) || !parser_word_or_parameter(parser, PARAM_COLUMN_VALUE, &value)) {
+        return false;
+    }
+    statement->has_column_value = true;
+    statement->column = column;
+    statement->column_value.assign(value);
+    return true;
+}
+
+static PrepareResult parse_select(Parser* parser, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->range_start = 0;
+    statement->range_end = UINT32_MAX;
+    statement->limit = UINT64_MAX;
+    statement->has_column_value = false;
+    bool parsed = true;
+    if (parser_accept_keyword(parser, "where")) {
+        do {
+            parsed = parse_condition(parser, statement);
+        } while (parsed && parser_accept_keyword(parser, "and"));
+    }
+    if (parsed && parser_accept_keyword(parser, "limit") && !parser_parameter(parser, PARAM_LIMIT)) {
+        parsed = parser->current.type == TOKEN_NUMBER &&
+                 parse_number(parser->current.text, UINT64_MAX, &statement->limit);
+        if (parsed) {
+            parser_advance(parser);
+        }
+    }
+    if (!parsed || !parser_end(parser)) {
+        return syntax_error();
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_delete(Parser* parser, Statement* statement) {
+    // delete <id> 或 delete where id between <a> and <b>
+    statement->type = STATEMENT_DELETE;
+    // 没绑定过的参数是 0
+    statement->range_start = 0;
+    statement->range_end = 0;
+    bool parsed;
+    if (parser_accept_keyword(parser, "where")) {
+        parsed = parser_accept_keyword(parser, "id") && parser_accept_keyword(parser, "between") &&
+                 (parser_parameter(parser, PARAM_RANGE_START) || parser_id(parser, &statement->range_start)) &&
+                 parser_accept_keyword(parser, "and") &&
+                 (parser_parameter(parser, PARAM_RANGE_END) || parser_id(parser, &statement->range_end));
+        statement->single_row = false;
+    } else {
+        parsed = parser_parameter(parser, PARAM_DELETE_ID) || parser_id(parser, &statement->range_start);
+        statement->range_end = statement->range_start;
+        statement->single_row = true;
+    }
+    if (!parsed || !parser_end(parser)) {
+        return syntax_error();
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_create_index(Parser* parser, Statement* statement) {
+    // create index on <table>(<column>)，和 create table 一样不区分表名
+    statement->type = STATEMENT_CREATE_INDEX;
+    if (!parser_accept_keyword(parser, "on") || !parser_accept(parser, TOKEN_IDENTIFIER) ||
+        !parser_accept(parser, TOKEN_LEFT_PAREN) || parser->current.type != TOKEN_IDENTIFIER) {
+        cout << "syntax error, create index on tableName(column);\n";
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (!parse_index_column(parser->current.text, &statement->column)) {
+        cout << "Only username and email can be indexed.\n";
+        return PREPARE_SYNTAX_ERROR;
+    }
+    parser_advance(parser);
+    if (!parser_accept(parser, TOKEN_RIGHT_PAREN) || !parser_end(parser)) {
+        cout << "syntax error, create index on tableName(column);\n";
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_create(Parser* parser, Statement* statement) {
+    if (parser_accept_keyword(parser, "index")) {
+        return parse_create_index(parser, statement);
+    }
+    statement->type = STATEMENT_CREATE;
+    vector<string>& colNames = statement->table_to_create.colNames;
+    vector<Type>& colTypes = statement->table_to_create.colTypes;
+    colNames.clear();
+    colTypes.clear();
+    bool parsed = parser_accept_keyword(parser, "table") && parser_accept(parser, TOKEN_IDENTIFIER) &&
+                  parser_accept(parser, TOKEN_LEFT_PAREN);
+    while (parsed) {
+        // 每一列是 <name> <type>
+        if (parser->current.type != TOKEN_IDENTIFIER) {
+            parsed = false;
+            break;
+        }
+        string_view name = parser->current.text;
+        parser_advance(parser);
+        if (parser->current.type != TOKEN_IDENTIFIER) {
+            parsed = false;
+            break;
+        }
+        string_view type = parser->current.text;
+        if (type == "INT") {
+            colTypes.push_back(INT);
+        } else if (type == "STRING") {
+            colTypes.push_back(STRING);
+        } else {
+            cout << "syntax error, unsupported type '" << type << "'\n";
+            return PREPARE_SYNTAX_ERROR;
+        }
+        colNames.emplace_back(name);
+        parser_advance(parser);
+        if (!parser_accept(parser, TOKEN_COMMA)) {
+            break;
+        }
+    }
+    if (!parsed || !parser_accept(parser, TOKEN_RIGHT_PAREN) || !parser_end(parser)) {
+        cout << "syntax error, create table tableName(col1 type1, col2 type2...);\n";
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_prepare(Parser* parser, Statement* statement) {
+    // prepare <name> as <statement>，正文留给 prepared_init 去解析
+    statement->type = STATEMENT_PREPARE;
+    if (parser->current.type != TOKEN_IDENTIFIER) {
+        return syntax_error();
+    }
+    statement->name.assign(parser->current.text);
+    parser_advance(parser);
+    if (!parser_accept_keyword(parser, "as") || parser->current.type == TOKEN_END) {
+        return syntax_error();
+    }
+    string_view input = parser->lexer.input;
+    statement->text.assign(input.substr(parser->current.text.data() - input.data()));
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_execute(Parser* parser, Statement* statement) {
+    // execute <name> <value> ...，每个值都是原样的一个词
+    statement->type = STATEMENT_EXECUTE;
+    if (parser->current.type != TOKEN_IDENTIFIER) {
+        return syntax_error();
+    }
+    statement->name.assign(parser->current.text);
+    parser_advance(parser);
+    statement->arguments.clear();
+    string_view word;
+    while (parser_word(parser, &word)) {
+        statement->arguments.emplace_back(word);
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_statement(Parser* parser, Statement* statement) {
+    if (parser_accept_keyword(parser, "insert")) {
+        return parse_insert(parser, statement);
+    }
+    if (parser_accept_keyword(parser, "select")) {
+        return parse_select(parser, statement);
+    }
+    if (parser_accept_keyword(parser, "delete")) {
+        return parse_delete(parser, statement);
+    }
+    if (parser_accept_keyword(parser, "create")) {
+        return parse_create(parser, statement);
+    }
+    // prepare 不能嵌套
+    if (parser->prepared == NULL && parser_accept_keyword(parser, "prepare")) {
+        return parse_prepare(parser, statement);
+    }
+    if (parser->prepared == NULL && parser_accept_keyword(parser, "execute")) {
+        return parse_execute(parser, statement);
+    }
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+PrepareResult prepare_statement(string_view input, Statement* statement) {
+    Parser parser;
+    lexer_init(&parser.lexer, input);
+    parser.prepared = NULL;
+    parser_advance(&parser);
+    return parse_statement(&parser, statement);
+}
+
+PrepareResult prepared_init(string_view input, PreparedStatement* prepared) {
+    Parser parser;
+    lexer_init(&parser.lexer, input);
+    parser.prepared = prepared;
+    parser_advance(&parser);
+    prepared->params.clear();
+    Statement* statement = &prepared->statement;
+    PrepareResult result = parse_statement(&parser, statement);
+    if (result == PREPARE_SUCCESS) {
+        prepared->range_start = statement->range_start;
+        prepared->range_end = statement->range_end;
+    }
+    return result;
+}
+
+PrepareResult prepared_bind_int(PreparedStatement* prepared, uint32_t index, uint64_t value) {
+    if (index >= prepared->params.size()) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    PreparedParam* param = &prepared->params[index];
+    Statement* statement = &prepared->statement;
+    if (param->target == PARAM_LIMIT) {
+        statement->limit = value;
+        return PREPARE_SUCCESS;
+    }
+    if (value > UINT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    uint32_t id = (uint32_t)value;
+    switch (param->target) {
+        case PARAM_INSERT_ID:
+            statement->row_to_insert.id = id;
+            break;
+        case PARAM_ID_CONDITION:
+            // 范围在执行前由所有 id 条件重新算出
+            param->value = id;
+            break;
+        case PARAM_DELETE_ID:
+            statement->range_start = id;
+            statement->range_end = id;
+            break;
+        case PARAM_RANGE_START:
+            statement->range_start = id;
+            break;
+        case PARAM_RANGE_END:
+            statement->range_end = id;
+            break;
+        default:
+            return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult bind_string(char* destination, uint32_t size, string_view value) {
+    if (value.size() > size) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(destination, value.data(), value.size());
+    destination[value.size()] = '\0';
+    return PREPARE_SUCCESS;
+}
+
+/* Text bound to an id or limit parameter must be a decimal number */
+PrepareResult prepared_bind_text(PreparedStatement* prepared, uint32_t index, string_view value) {
+    if (index >= prepared->params.size()) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Statement* statement = &prepared->statement;
+    switch (prepared->params[index].target) {
+        case PARAM_INSERT_USERNAME:
+            return bind_string(statement->row_to_insert.username, COLUMN_USERNAME_SIZE, value);
+        case PARAM_INSERT_EMAIL:
+            return bind_string(statement->row_to_insert.email, COLUMN_EMAIL_SIZE, value);
+        case PARAM_COLUMN_VALUE:
+            statement->column_value.assign(value);
+            return PREPARE_SUCCESS;
+        default:
+            break;
+    }
+    uint64_t number;
+    if (!parse_number(value, UINT64_MAX, &number)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return prepared_bind_int(prepared, index, number);
+}
+
+ExecuteResult prepared_execute(PreparedStatement* prepared, Table* table, ResultSink* sink) {
+    Statement* statement = &prepared->statement;
+    if (statement->type == STATEMENT_SELECT) {
+        statement->range_start = prepared->range_start;
+        statement->range_end = prepared->range_end;
+        for (const PreparedParam& param : prepared->params) {
+            if (param.target == PARAM_ID_CONDITION) {
+                apply_id_condition(param.op, param.value, statement);
+            }
+        }
+    }
+    return execute_statement(statement, table, sink);
+}
@@ -0,0 +1,110 @@
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#endif
+
+uint32_t search_lower_bound_scalar(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (keys[index] >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+typedef uint32_t (*CountLessFn)(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+
+static uint32_t count_less_portable(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        count += keys[i] < key;
+    }
+    return count;
+}
+
+#ifdef SEARCH_X86
+/*
+SSE2/AVX2 only compare signed integers; flipping the sign bit of both
+sides turns the unsigned order into the signed one.
+*/
+static uint32_t count_less_sse2(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i needle = _mm_xor_si128(_mm_set1_epi32((int32_t)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= num_keys; i += 4) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), bias);
+        __m128i less = _mm_cmpgt_epi32(needle, block);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+    }
+    return count + count_less_portable(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("avx2")))
+static uint32_t count_less_avx2(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32((int32_t)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= num_keys; i += 8) {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), bias);
+        __m256i less = _mm256_cmpgt_epi32(needle, block);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+    // 剩下不足 8 个时用一次 SSE2 比较
+    if (i + 4 <= num_keys) {
+        const __m128i bias128 = _mm_set1_epi32(INT32_MIN);
+        const __m128i needle128 = _mm_xor_si128(_mm_set1_epi32((int32_t)key), bias128);
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), bias128);
+        __m128i less = _mm_cmpgt_epi32(needle128, block);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+        i += 4;
+    }
+    return count + count_less_portable(keys + i, num_keys - i, key);
+}
+#endif
+
+static CountLessFn choose_count_less(const char** name) {
+#ifdef SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return count_less_avx2;
+    }
+    *name = "sse2";
+    return count_less_sse2;
+#else
+    *name = "scalar";
+    return count_less_portable;
+#endif
+}
+
+static const char* count_less_name = "";
+static const CountLessFn count_less = choose_count_less(&count_less_name);
+
+uint32_t search_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    /*
+    The answer stays within [base, base + length]. Each step keeps one
+    half without branching on the comparison, so the compiler emits a
+    conditional move.
+    */
+    const uint32_t* base = keys;
+    uint32_t length = num_keys;
+    while (length > SEARCH_LINEAR_KEYS) {
+        uint32_t half = length / 2;
+        base = (base[half - 1] < key) ? base + half : base;
+        length -= half;
+    }
+    return (uint32_t)(base - keys) + count_less(base, length, key);
+}
+
+const char* search_implementation() {
+    return count_less_name;
+}
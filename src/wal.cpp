@@ -0,0 +1,309 @@
+#include "wal.h"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+/*
+Fletcher-style checksum over 32-bit words. size must be a
+multiple of 4; seed chains the checksum of the previous frame.
+*/
+uint32_t wal_checksum(const void* data, size_t size, uint32_t seed) {
+    const uint32_t* words = static_cast<const uint32_t*>(data);
+    uint32_t s1 = seed;
+    uint32_t s2 = ~seed;
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        s1 += words[i] + s2;
+        s2 += words[i] + s1;
+    }
+    return s1 ^ (s2 << 7) ^ (s2 >> 25);
+}
+
+static void wal_write_header(Wal* wal) {
+    WalHeader header;
+    header.magic = WAL_MAGIC;
+    header.version = WAL_VERSION;
+    header.page_size = wal->page_size;
+    header.salt = wal->salt;
+    header.checksum = wal_checksum(&header, WAL_HEADER_SIZE - sizeof(uint32_t), 0);
+    if (pwrite(wal->file_descriptor, &header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE) {
+        cout << "Error writing WAL header: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    wal->checksum = header.checksum;
+    wal->file_size = WAL_HEADER_SIZE;
+    wal->num_frames = 0;
+}
+
+static void wal_flusher_main(Wal* wal) {
+    unique_lock<mutex> lock(wal->mutex);
+    while (!wal->stop) {
+        /*
+        Sleep for one group-commit window unless a committer is
+        waiting; everything written meanwhile shares one fsync.
+        */
+        wal->sync_requested.wait_for(lock, chrono::milliseconds(wal->group_commit_ms), [wal] {
+            return wal->stop || (wal->waiters > 0 && wal->written_lsn > wal->synced_lsn);
+        });
+        if (wal->written_lsn > wal->synced_lsn) {
+            uint64_t target = wal->written_lsn;
+            lock.unlock();
+            fdatasync(wal->file_descriptor);
+            lock.lock();
+            if (target > wal->synced_lsn) {
+                wal->synced_lsn = target;
+            }
+            wal->stats.syncs += 1;
+            wal->synced.notify_all();
+        }
+    }
+}
+
+Wal* wal_open(const char* db_filename, int db_file_descriptor, uint32_t page_size,
+              WalSyncMode sync_mode, uint32_t group_commit_ms) {
+    Wal* wal = new Wal();
+    wal->path = string(db_filename) + "-wal";
+    wal->file_descriptor = open(wal->path.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (wal->file_descriptor == -1) {
+        cout << "Unable to open WAL file." << endl;
+        exit(EXIT_FAILURE);
+    }
+    wal->page_size = page_size;
+    wal->sync_mode = sync_mode;
+    wal->group_commit_ms = group_commit_ms > 0 ? group_commit_ms : 1;
+    wal->salt = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+    wal->stats = {};
+
+    wal->stats.recovered_frames = wal_recover(wal, db_file_descriptor);
+
+    /* Start a fresh log; anything recovered is already in the db file */
+    if (ftruncate(wal->file_descriptor, 0) == -1) {
+        cout << "Error truncating WAL: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    wal->salt += 1;
+    wal_write_header(wal);
+    fdatasync(wal->file_descriptor);
+
+    wal->written_lsn = 0;
+    wal->synced_lsn = 0;
+    wal->waiters = 0;
+    wal->stop = false;
+    wal->flusher = thread(wal_flusher_main, wal);
+    return wal;
+}
+
+/*
+Only call after the db file holds every committed page
+(see pager_checkpoint); the log is removed.
+*/
+void wal_close(Wal* wal) {
+    {
+        lock_guard<mutex> lock(wal->mutex);
+        wal->stop = true;
+    }
+    wal->sync_requested.notify_all();
+    wal->flusher.join();
+    close(wal->file_descriptor);
+    unlink(wal->path.c_str());
+    delete wal;
+}
+
+/*
+Redo committed frames into the db file. The first pass walks the
+checksum chain to find the end of the last commit frame; the second
+pass copies every frame before that point to its page. Returns the
+number of frames applied.
+*/
+uint32_t wal_recover(Wal* wal, int db_file_descriptor) {
+    int fd = wal->file_descriptor;
+    WalHeader header;
+    if (pread(fd, &header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE) {
+        return 0;
+    }
+    if (header.magic != WAL_MAGIC || header.version != WAL_VERSION ||
+        header.page_size != wal->page_size ||
+        header.checksum != wal_checksum(&header, WAL_HEADER_SIZE - sizeof(uint32_t), 0)) {
+        return 0;
+    }
+    wal->salt = header.salt;
+
+    uint32_t frame_size = WAL_FRAME_HEADER_SIZE + wal->page_size;
+    vector<char> frame(frame_size);
+    WalFrameHeader* frame_header = reinterpret_cast<WalFrameHeader*>(frame.data());
+    char* page = frame.data() + WAL_FRAME_HEADER_SIZE;
+
+    uint32_t checksum = header.checksum;
+    off_t offset = WAL_HEADER_SIZE;
+    off_t last_commit_end = WAL_HEADER_SIZE;
+    uint32_t last_db_size = 0;
+    while (pread(fd, frame.data(), frame_size, offset) == (ssize_t)frame_size) {
+        if (frame_header->salt != header.salt) {
+            break;
+        }
+        uint32_t expected = wal_checksum(frame_header, WAL_FRAME_HEADER_SIZE - sizeof(uint32_t), checksum);
+        expected = wal_checksum(page, wal->page_size, expected);
+        if (frame_header->checksum != expected) {
+            // 尾部写了一半的帧
+            break;
+        }
+        checksum = expected;
+        offset += frame_size;
+        if (frame_header->db_size != 0) {
+            last_commit_end = offset;
+            last_db_size = frame_header->db_size;
+        }
+    }
+
+    uint32_t applied = 0;
+    for (offset = WAL_HEADER_SIZE; offset < last_commit_end; offset += frame_size) {
+        if (pread(fd, frame.data(), frame_size, offset) != (ssize_t)frame_size) {
+            cout << "Error reading WAL: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        off_t db_offset = (off_t)frame_header->page_num * wal->page_size;
+        if (pwrite(db_file_descriptor, page, wal->page_size, db_offset) != (ssize_t)wal->page_size) {
+            cout << "Error writing recovered page: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        applied++;
+    }
+    if (applied > 0) {
+        struct stat st;
+        if (fstat(db_file_descriptor, &st) == 0 &&
+            st.st_size > (off_t)last_db_size * wal->page_size) {
+            ftruncate(db_file_descriptor, (off_t)last_db_size * wal->page_size);
+        }
+        fsync(db_file_descriptor);
+    }
+    return applied;
+}
+
+/*
+Append one statement's pages; the last one becomes the commit frame.
+Returns the LSN the statement is durable at once synced_lsn reaches it.
+*/
+uint64_t wal_commit(Wal* wal, const uint32_t* page_nums, void* const* pages,
+                    uint32_t count, uint32_t db_size) {
+    if (count == 0) {
+        return wal->written_lsn;
+    }
+    vector<WalFrameHeader> headers(count);
+    vector<struct iovec> iov(2 * count);
+    uint32_t checksum = wal->checksum;
+    for (uint32_t i = 0; i < count; i++) {
+        WalFrameHeader* h = &headers[i];
+        h->page_num = page_nums[i];
+        h->db_size = (i == count - 1) ? db_size : 0;
+        h->salt = wal->salt;
+        checksum = wal_checksum(h, WAL_FRAME_HEADER_SIZE - sizeof(uint32_t), checksum);
+        checksum = wal_checksum(pages[i], wal->page_size, checksum);
+        h->checksum = checksum;
+        iov[2 * i].iov_base = h;
+        iov[2 * i].iov_len = WAL_FRAME_HEADER_SIZE;
+        iov[2 * i + 1].iov_base = pages[i];
+        iov[2 * i + 1].iov_len = wal->page_size;
+    }
+
+    size_t bytes = (size_t)count * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+    off_t offset = wal->file_size;
+    for (size_t start = 0; start < iov.size(); start += IOV_MAX) {
+        int n = (int)min((size_t)IOV_MAX, iov.size() - start);
+        ssize_t chunk = 0;
+        for (int i = 0; i < n; i++) {
+            chunk += iov[start + i].iov_len;
+        }
+        if (pwritev(wal->file_descriptor, &iov[start], n, offset) != chunk) {
+            cout << "Error writing WAL: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        offset += chunk;
+    }
+    wal->checksum = checksum;
+    wal->file_size = offset;
+    wal->num_frames += count;
+
+    uint64_t lsn;
+    {
+        lock_guard<mutex> lock(wal->mutex);
+        wal->written_lsn += bytes;
+        lsn = wal->written_lsn;
+        wal->stats.commits += 1;
+        wal->stats.frames += count;
+    }
+    if (wal->sync_mode == WAL_SYNC_FULL) {
+        wal_wait_synced(wal, lsn);
+    }
+    return lsn;
+}
+
+/*
+Group commit: block until the flusher's fsync covers lsn. Committers
+arriving while an fsync is in flight are all released by the next one.
+*/
+void wal_wait_synced(Wal* wal, uint64_t lsn) {
+    unique_lock<mutex> lock(wal->mutex);
+    if (wal->synced_lsn >= lsn) {
+        return;
+    }
+    wal->waiters += 1;
+    wal->sync_requested.notify_one();
+    wal->synced.wait(lock, [wal, lsn] { return wal->synced_lsn >= lsn; });
+    wal->waiters -= 1;
+}
+
+/*
+Synchronously make everything written so far durable. The pager
+calls this before any page reaches the db file (log before data).
+*/
+void wal_sync(Wal* wal) {
+    unique_lock<mutex> lock(wal->mutex);
+    if (wal->written_lsn <= wal->synced_lsn) {
+        return;
+    }
+    uint64_t target = wal->written_lsn;
+    lock.unlock();
+    fdatasync(wal->file_descriptor);
+    lock.lock();
+    if (target > wal->synced_lsn) {
+        wal->synced_lsn = target;
+    }
+    wal->stats.syncs += 1;
+    wal->synced.notify_all();
+}
+
+/*
+Called after a checkpoint made the db file durable: drop every
+frame and start over with a new salt.
+*/
+void wal_reset(Wal* wal) {
+    lock_guard<mutex> lock(wal->mutex);
+    if (ftruncate(wal->file_descriptor, 0) == -1) {
+        cout << "Error truncating WAL: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    wal->salt += 1;
+    wal_write_header(wal);
+    wal->synced_lsn = wal->written_lsn;
+    wal->stats.checkpoints += 1;
+    wal->synced.notify_all();
+}
+
+void print_wal_stats(Wal* wal) {
+    lock_guard<mutex> lock(wal->mutex);
+    cout << "wal_frames: " << wal->num_frames << "\n";
+    cout << "wal_commits: " << wal->stats.commits << "\n";
+    cout << "wal_syncs: " << wal->stats.syncs << "\n";
+    cout << "wal_checkpoints: " << wal->stats.checkpoints << "\n";
+    cout << "wal_recovered_frames: " << wal->stats.recovered_frames << endl;
+}
@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+#include "api.h"
+#include "mydb.h"   // 建索引、查索引用引擎内部的接口
+#include <thread>
+
+// 直接链接引擎库，在进程内调用嵌入接口
+class ApiTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::remove("api_test.db");
+        std::remove("api_test.db-wal");
+        db_options_init(&options);
+    }
+
+    void TearDown() override {
+        std::remove("api_test.db");
+        std::remove("api_test.db-wal");
+    }
+
+    Row makeRow(uint32_t id) {
+        Row row;
+        row.id = id;
+        snprintf(row.username, sizeof(row.username), "user%u", id);
+        snprintf(row.email, sizeof(row.email), "person%u@example.com", id);
+        return row;
+    }
+
+    DbOptions options;
+};
+
+TEST_F(ApiTest, inserts_gets_and_deletes_rows) {
+    Table* table = db_open("api_test.db", &options);
+    for (uint32_t i = 0; i < 500; i++) {
+        Row row = makeRow(i * 7 % 500);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+    Row row = makeRow(42);
+    EXPECT_EQ(db_insert(table, &row), EXECUTE_DUPLICATE_KEY);
+    EXPECT_EQ(db_delete(table, 42), EXECUTE_SUCCESS);
+    EXPECT_EQ(db_delete(table, 42), EXECUTE_KEY_NOT_FOUND);
+    EXPECT_FALSE(db_get(table, 42, &row));
+    db_close(table);
+
+    // 重新打开后还在
+    table = db_open("api_test.db", &options);
+    ASSERT_TRUE(db_get(table, 43, &row));
+    EXPECT_EQ(row.id, 43u);
+    EXPECT_STREQ(row.username, "user43");
+    EXPECT_STREQ(row.email, "person43@example.com");
+    EXPECT_FALSE(db_get(table, 42, &row));
+    EXPECT_FALSE(db_get(table, 500, &row));
+    db_close(table);
+}
+
+// B 树和哈希表各跑一遍
+class ApiOrganizationTest : public ApiTest, public ::testing::WithParamInterface<TableOrganization> {};
+
+TEST_P(ApiOrganizationTest, scans_in_id_order_while_the_same_thread_writes) {
+    options.organization = GetParam();
+    Table* table = db_open("api_test.db", &options);
+    for (uint32_t i = 1000; i > 0; i--) {
+        Row row = makeRow(i * 2);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+
+    // 扫描过程中删掉拿到的行，扫描不持有 latch，所以不会卡住
+    DbScan* scan = db_scan_begin(table, 101, 1900);
+    Row row;
+    uint32_t expected = 102;
+    while (db_scan_next(scan, &row)) {
+        ASSERT_EQ(row.id, expected);
+        EXPECT_EQ(row.username, "user" + std::to_string(expected));
+        ASSERT_EQ(db_delete(table, row.id), EXECUTE_SUCCESS);
+        expected += 2;
+    }
+    db_scan_end(scan);
+    EXPECT_EQ(expected, 1902u);
+
+    scan = db_scan_begin(table, 0, UINT32_MAX);
+    uint32_t count = 0;
+    while (db_scan_next(scan, &row)) {
+        EXPECT_TRUE(row.id < 101 || row.id > 1900);
+        count++;
+    }
+    db_scan_end(scan);
+    EXPECT_EQ(count, 50u + 50u);
+
+    scan = db_scan_begin(table, 10, 9);
+    EXPECT_FALSE(db_scan_next(scan, &row));
+    db_scan_end(scan);
+    db_close(table);
+}
+
+TEST_P(ApiOrganizationTest, updates_rows_that_grow_and_keeps_indexes_in_step) {
+    options.organization = GetParam();
+    Table* table = db_open("api_test.db", &options);
+    for (uint32_t i = 0; i < 300; i++) {
+        Row row = makeRow(i);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+    Statement statement;
+    ASSERT_EQ(prepare_statement("create index on users(email)", &statement), PREPARE_SUCCESS);
+    ASSERT_EQ(execute_statement(&statement, table, NULL), EXECUTE_SUCCESS);
+
+    // 邮箱加到最长，叶子放不下时行要挪走或分裂
+    for (uint32_t i = 0; i < 300; i++) {
+        Row row = makeRow(i);
+        std::string email = "long" + std::to_string(i) + "@";
+        email += std::string(COLUMN_EMAIL_SIZE - email.size(), 'e');
+        snprintf(row.email, sizeof(row.email), "%s", email.c_str());
+        ASSERT_EQ(db_update(table, &row), EXECUTE_SUCCESS);
+    }
+    db_close(table);
+
+    table = db_open("api_test.db", &options);
+    Row row;
+    uint32_t count = 0;
+    DbScan* scan = db_scan_begin(table, 0, UINT32_MAX);
+    while (db_scan_next(scan, &row)) {
+        EXPECT_EQ(row.id, count);
+        EXPECT_EQ(std::string(row.email).substr(0, 4), "long");
+        EXPECT_EQ(strlen(row.email), (size_t)COLUMN_EMAIL_SIZE);
+        count++;
+    }
+    db_scan_end(scan);
+    EXPECT_EQ(count, 300u);
+    std::vector<uint32_t> ids;
+    index_lookup(table->indexes[INDEX_COLUMN_EMAIL], "person7@example.com", &ids);
+    EXPECT_TRUE(ids.empty());
+    ASSERT_TRUE(db_get(table, 7, &row));
+    index_lookup(table->indexes[INDEX_COLUMN_EMAIL], row.email, &ids);
+    EXPECT_EQ(ids, std::vector<uint32_t>{7});
+    db_close(table);
+}
+
+TEST_P(ApiOrganizationTest, readers_never_miss_rows_being_updated) {
+    options.organization = GetParam();
+    Table* table = db_open("api_test.db", &options);
+    for (uint32_t i = 0; i < 200; i++) {
+        Row row = makeRow(i);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+        // 长短交替，原地覆盖和挪位置两条路都会走到
+        for (uint32_t round = 0; round < 20; round++) {
+            for (uint32_t i = 0; i < 200; i++) {
+                Row row = makeRow(i);
+                if (round % 2 == 0) {
+                    memset(row.email, 'e', COLUMN_EMAIL_SIZE);
+                    row.email[COLUMN_EMAIL_SIZE] = '\0';
+                }
+                db_update(table, &row);
+            }
+        }
+        stop = true;
+    });
+    uint64_t misses = 0;
+    Row row;
+    while (!stop) {
+        for (uint32_t i = 0; i < 200; i++) {
+            if (!db_get(table, i, &row) || row.id != i) {
+                misses++;
+            }
+        }
+    }
+    writer.join();
+    EXPECT_EQ(misses, 0u);
+    db_close(table);
+}
+
+INSTANTIATE_TEST_SUITE_P(Organizations, ApiOrganizationTest, ::testing::Values(TABLE_BTREE, TABLE_HASH));
+
+TEST_F(ApiTest, updates_replace_rows_durably) {
+    Table* table = db_open("api_test.db", &options);
+    for (uint32_t i = 0; i < 100; i++) {
+        Row row = makeRow(i);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+    Row row = makeRow(7);
+    snprintf(row.email, sizeof(row.email), "changed@example.com");
+    EXPECT_EQ(db_update(table, &row), EXECUTE_SUCCESS);
+    row = makeRow(100);
+    EXPECT_EQ(db_update(table, &row), EXECUTE_KEY_NOT_FOUND);
+    EXPECT_FALSE(db_get(table, 100, &row));
+    db_close(table);
+
+    table = db_open("api_test.db", &options);
+    ASSERT_TRUE(db_get(table, 7, &row));
+    EXPECT_STREQ(row.username, "user7");
+    EXPECT_STREQ(row.email, "changed@example.com");
+    db_close(table);
+}
+
+TEST_F(ApiTest, readers_scan_while_the_writer_splits_and_merges_nodes) {
+    // 最小的缓冲池加上宽行和小的内部节点，读者一边扫一边换页，写者一边分裂合并
+    options.num_frames = PAGER_MIN_NUM_FRAMES;
+    options.internal_node_max_cells = 3;
+    options.wal_sync = WAL_SYNC_NORMAL;
+    Table* table = db_open("api_test.db", &options);
+    auto wideRow = [this](uint32_t id) {
+        Row row = makeRow(id);
+        memset(row.email, 'e', COLUMN_EMAIL_SIZE);
+        row.email[COLUMN_EMAIL_SIZE] = '\0';
+        return row;
+    };
+    // 偶数 id 一直在，奇数 id 由写者反复插入再删掉
+    const uint32_t num_rows = 600;
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        Row row = wideRow(i * 2);
+        ASSERT_EQ(db_insert(table, &row), EXECUTE_SUCCESS);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint32_t> writer_errors(0);
+    std::thread writer([&] {
+        for (uint32_t round = 0; round < 3; round++) {
+            // 7 和 11 都与 600 互素，i * 7 % 600 打乱 0..599 的顺序
+            for (uint32_t i = 0; i < num_rows; i++) {
+                Row row = wideRow((i * 7 % num_rows) * 2 + 1);
+                if (db_insert(table, &row) != EXECUTE_SUCCESS) {
+                    writer_errors++;
+                }
+            }
+            for (uint32_t i = 0; i < num_rows; i++) {
+                if (db_delete(table, (i * 11 % num_rows) * 2 + 1) != EXECUTE_SUCCESS) {
+                    writer_errors++;
+                }
+            }
+        }
+        stop = true;
+    });
+
+    std::atomic<uint32_t> unsorted(0);
+    std::atomic<uint32_t> missing(0);
+    std::atomic<uint32_t> scans(0);
+    std::vector<std::thread> readers;
+    for (uint32_t t = 0; t < 3; t++) {
+        readers.emplace_back([&, t] {
+            Row row;
+            while (!stop) {
+                uint32_t start = t * 200;
+                DbScan* scan = db_scan_begin(table, start, UINT32_MAX);
+                uint32_t last = 0;
+                bool first = true;
+                uint32_t evens = 0;
+                while (db_scan_next(scan, &row)) {
+                    if (!first && row.id <= last) {
+                        unsorted++;
+                    }
+                    if (row.id % 2 == 0) {
+                        evens++;
+                    }
+                    first = false;
+                    last = row.id;
+                }
+                db_scan_end(scan);
+                if (evens != (num_rows * 2 - std::max(start, 2u)) / 2 + 1) {
+                    missing++;
+                }
+                for (uint32_t id = 2; id <= num_rows * 2; id += 38) {
+                    if (!db_get(table, id, &row) || row.id != id) {
+                        missing++;
+                    }
+                }
+                scans++;
+            }
+        });
+    }
+    writer.join();
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(writer_errors, 0u);
+    EXPECT_EQ(unsorted, 0u);
+    EXPECT_EQ(missing, 0u);
+    EXPECT_GT(scans, 0u);
+
+    // 和 .stats 一样：所有线程都结束后不应该还有页被 pin 住
+    testing::internal::CaptureStdout();
+    print_pager_stats(table->pager);
+    std::string stats = testing::internal::GetCapturedStdout();
+    EXPECT_NE(stats.find("\npinned: 0\n"), std::string::npos) << stats;
+    size_t evictions = stats.find("\nevictions: ");
+    ASSERT_NE(evictions, std::string::npos);
+    EXPECT_GT(std::stoul(stats.substr(evictions + 12)), 0u);
+    db_close(table);
+}
+
+// 引擎内部的接口，不经过 myDB
+TEST(PreparedTest, deletes_start_with_unbound_parameters_as_zero) {
+    PreparedStatement prepared;
+    prepared.statement.range_start = 7;
+    prepared.statement.range_end = 7;
+    ASSERT_EQ(prepared_init("delete ?", &prepared), PREPARE_SUCCESS);
+    EXPECT_EQ(prepared.range_start, 0u);
+    EXPECT_EQ(prepared.range_end, 0u);
+
+    prepared.statement.range_start = 7;
+    prepared.statement.range_end = 7;
+    ASSERT_EQ(prepared_init("delete where id between ? and ?", &prepared), PREPARE_SUCCESS);
+    EXPECT_EQ(prepared.range_start, 0u);
+    EXPECT_EQ(prepared.range_end, 0u);
+}
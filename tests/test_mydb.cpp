@@ -9,6 +9,7 @@ protected:
         std::remove("test_input.txt");
         std::remove("test_output.txt");
         std::remove("test.db");
+        std::remove("test.db-wal");
     }
     
     void TearDown() override {
@@ -17,7 +18,7 @@ protected:
         std::remove("test_output.txt");
     }
     
-    std::string runMyDB(const std::string& input) {
+    std::string runMyDB(const std::string& input, const std::string& args = "") {
         // 1. 创建输入文件
         {
             std::ofstream in("test_input.txt");
@@ -26,7 +27,7 @@ protected:
         }
         
         // 2. 运行程序（重定向输入输出）
-        std::string command = "./myDB test.db < test_input.txt > test_output.txt";
+        std::string command = "./myDB " + args + " test.db < test_input.txt > test_output.txt";
         int result = std::system(command.c_str());
         
         // 3. 读取输出文件
@@ -42,6 +43,19 @@ protected:
         return buffer.str();
     }
 
+    // 输入执行完后进程被 SIGKILL 杀掉，模拟崩溃（不会执行 .exit）
+    void runMyDBAndKill(const std::string& input, const std::string& args = "") {
+        {
+            std::ofstream in("test_input.txt");
+            in << input << std::endl;
+            in.close();
+        }
+        // stdin 只需比 1 秒的 KILL 多开一会儿，myDB 读不到 EOF 就不会自己退出
+        std::string command = "(cat test_input.txt; sleep 2) | timeout -s KILL 1 ./myDB " + args +
+                              " test.db > test_output.txt 2>&1";
+        std::system(command.c_str());
+    }
+
     std::vector<std::string> splitLines(const std::string& text) {
         std::vector<std::string> lines;
         std::stringstream ss(text);
@@ -53,6 +67,36 @@ protected:
         
         return lines;
     }
+
+    // 编码后正好是最长的行（32 字节用户名、255 字节邮箱），一个叶子只放得下 13 行，
+    // 依赖树形状的测试用它来凑出多层的树
+    std::string wideUsername(int id) {
+        std::string username = "user" + std::to_string(id);
+        return username + std::string(32 - username.size(), 'u');
+    }
+
+    std::string wideEmail(int id) {
+        std::string email = "person" + std::to_string(id);
+        return email + std::string(255 - 12 - email.size(), 'e') + "@example.com";
+    }
+
+    std::string wideInsert(int id) {
+        return "insert " + std::to_string(id) + " " + wideUsername(id) + " " + wideEmail(id) + "\n";
+    }
+
+    std::string wideRow(int id) {
+        return "(" + std::to_string(id) + ", " + wideUsername(id) + ", " + wideEmail(id) + ")";
+    }
+
+    // 返回以 prefix 开头的第一行，找不到时返回空串
+    std::string findLine(const std::vector<std::string>& lines, const std::string& prefix) {
+        for (const std::string& line : lines) {
+            if (line.compare(0, prefix.size(), prefix) == 0) {
+                return line;
+            }
+        }
+        return "";
+    }
 };
 
 TEST_F(DatabaseTest, inserts_and_retrieves_a_row) {
@@ -355,10 +399,10 @@ TEST_F(DatabaseTest, allows_printing_out_the_structure_of_a_3_leaf_node_btree) {
     std::string input = "";
 
     for (int i=1; i < 15; ++i) {
-        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+        input += wideInsert(i);
     }
     input += ".btree\n";
-    input += "insert 15 user15 person15@example.com\n";
+    input += wideInsert(15);
     input += ".exit";
     std::string output = runMyDB(input);
     
@@ -373,7 +417,7 @@ TEST_F(DatabaseTest, allows_printing_out_the_structure_of_a_3_leaf_node_btree) {
     std::vector<std::string> expected = {
         "db > Tree:",
         "- internal (size 1)",
-        "  - leaf (size 7)",
+        "  - leaf (size 13)",
         "    - 1",
         "    - 2",
         "    - 3",
@@ -381,14 +425,14 @@ TEST_F(DatabaseTest, allows_printing_out_the_structure_of_a_3_leaf_node_btree) {
         "    - 5",
         "    - 6",
         "    - 7",
-        "  - key 7",
-        "  - leaf (size 7)",
         "    - 8",
         "    - 9",
         "    - 10",
         "    - 11",
         "    - 12",
         "    - 13",
+        "  - key 13",
+        "  - leaf (size 1)",
         "    - 14",
         "db > Executed.",
         "db > "
@@ -412,7 +456,7 @@ TEST_F(DatabaseTest, prints_all_rows_in_a_multi_level_tree) {
     std::string input = "";
 
     for (int i=1; i < 16; ++i) {
-        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+        input += wideInsert(i);
     }
     input += "select\n";
     input += ".exit";
@@ -426,24 +470,12 @@ TEST_F(DatabaseTest, prints_all_rows_in_a_multi_level_tree) {
     // }
     
     // 期望的输出行（根据你的程序实际输出调整）
-    std::vector<std::string> expected = {
-        "db > (1, user1, person1@example.com)",
-        "(2, user2, person2@example.com)",
-        "(3, user3, person3@example.com)",
-        "(4, user4, person4@example.com)",
-        "(5, user5, person5@example.com)",
-        "(6, user6, person6@example.com)",
-        "(7, user7, person7@example.com)",
-        "(8, user8, person8@example.com)",
-        "(9, user9, person9@example.com)",
-        "(10, user10, person10@example.com)",
-        "(11, user11, person11@example.com)",
-        "(12, user12, person12@example.com)",
-        "(13, user13, person13@example.com)",
-        "(14, user14, person14@example.com)",
-        "(15, user15, person15@example.com)",
-        "Executed.", "db > "
-    };
+    std::vector<std::string> expected;
+    for (int i=1; i < 16; ++i) {
+        expected.push_back(i == 1 ? "db > " + wideRow(i) : wideRow(i));
+    }
+    expected.push_back("Executed.");
+    expected.push_back("db > ");
     
     // 逐行比较
     for (size_t i = 15; i < std::min(lines.size(), expected.size()); ++i) {
@@ -475,12 +507,13 @@ TEST_F(DatabaseTest, prints_constants) {
     // 期望的输出行（根据你的程序实际输出调整）
     std::vector<std::string> expected = {
         "db > Constants:",
-        "ROW_SIZE: 293",
+        "ROW_MAX_SIZE: 289",
         "COMMON_NODE_HEADER_SIZE: 6",
-        "LEAF_NODE_HEADER_SIZE: 14",
-        "LEAF_NODE_CELL_SIZE: 297",
-        "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-        "LEAF_NODE_MAX_CELLS: 13",
+        "LEAF_NODE_HEADER_SIZE: 16",
+        "LEAF_NODE_CELL_OVERHEAD: 6",
+        "LEAF_NODE_SPACE_FOR_CELLS: 4080",
+        "LEAF_NODE_MAX_CELL_SIZE: 295",
+        "INTERNAL_NODE_MAX_CELLS: 510",
         "db > ",
     };
     
@@ -499,48 +532,48 @@ TEST_F(DatabaseTest, prints_constants) {
 }
 
 TEST_F(DatabaseTest, allows_printing_out_the_structure_of_a_4_leaf_node_btree) {
-    std::vector<std::string> input_lines = {
-        "insert 18 user18 person18@example.com",
-        "insert 7 user7 person7@example.com",
-        "insert 10 user10 person10@example.com",
-        "insert 29 user29 person29@example.com",
-        "insert 23 user23 person23@example.com",
-        "insert 4 user4 person4@example.com",
-        "insert 14 user14 person14@example.com",
-        "insert 30 user30 person30@example.com",
-        "insert 15 user15 person15@example.com",
-        "insert 26 user26 person26@example.com",
-        "insert 22 user22 person22@example.com",
-        "insert 19 user19 person19@example.com",
-        "insert 2 user2 person2@example.com",
-        "insert 1 user1 person1@example.com",
-        "insert 21 user21 person21@example.com",
-        "insert 11 user11 person11@example.com",
-        "insert 6 user6 person6@example.com",
-        "insert 20 user20 person20@example.com",
-        "insert 5 user5 person5@example.com",
-        "insert 8 user8 person8@example.com",
-        "insert 9 user9 person9@example.com",
-        "insert 3 user3 person3@example.com",
-        "insert 12 user12 person12@example.com",
-        "insert 27 user27 person27@example.com",
-        "insert 17 user17 person17@example.com",
-        "insert 16 user16 person16@example.com",
-        "insert 13 user13 person13@example.com",
-        "insert 24 user24 person24@example.com",
-        "insert 25 user25 person25@example.com",
-        "insert 28 user28 person28@example.com",
+    std::vector<int> ids = {
+        18,
+        7,
+        10,
+        29,
+        23,
+        4,
+        14,
+        30,
+        15,
+        26,
+        22,
+        19,
+        2,
+        1,
+        21,
+        11,
+        6,
+        20,
+        5,
+        8,
+        9,
+        3,
+        12,
+        27,
+        17,
+        16,
+        13,
+        24,
+        25,
+        28,
     };
 
     std::string input = "";
 
-    for (size_t i = 0; i < input_lines.size(); ++i) {
-        input += input_lines[i] + "\n";
+    for (size_t i = 0; i < ids.size(); ++i) {
+        input += wideInsert(ids[i]);
     }
 
     input += ".btree\n";
     input += ".exit";
-    std::string output = runMyDB(input);
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
     
     // 分割成行
     std::vector<std::string> lines = splitLines(output);
@@ -575,7 +608,653 @@ TEST_F(DatabaseTest, allows_printing_out_the_structure_of_a_4_leaf_node_btree) {
     //     << " lines, got " << lines.size() << " lines.";
 }
 
+TEST_F(DatabaseTest, keeps_rows_sorted_after_random_inserts_with_internal_splits) {
+    std::string input = "";
+
+    // 37 与 101 互素，i * 37 % 101 遍历 1..100 且顺序打乱
+    for (int i=1; i <= 100; ++i) {
+        int key = i * 37 % 101;
+        input += wideInsert(key);
+    }
+    input += "select\n";
+    input += ".exit";
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+
+    ASSERT_EQ(lines.size(), 202u);
+    EXPECT_EQ(lines[100], "db > " + wideRow(1));
+    for (int i=2; i <= 100; ++i) {
+        EXPECT_EQ(lines[99 + i], wideRow(i));
+    }
+    EXPECT_EQ(lines[200], "Executed.");
+}
+
+TEST_F(DatabaseTest, keeps_nodes_full_when_keys_are_appended_in_order) {
+    std::string input = "";
+    for (int i=1; i <= 80; ++i) {
+        input += wideInsert(i);
+    }
+    input += ".btree\n";
+    input += ".exit";
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+
+    // 顺序追加时旧节点保持写满：80 = 6 * 13 + 2
+    int full_leaves = 0;
+    int other_leaves = 0;
+    std::vector<std::string> internals;
+    for (const std::string& line : lines) {
+        if (line.find("- leaf (size 13)") != std::string::npos) {
+            full_leaves++;
+        } else if (line.find("- leaf (size") != std::string::npos) {
+            other_leaves++;
+            EXPECT_EQ(line, "    - leaf (size 2)");
+        } else if (line.find("internal") != std::string::npos) {
+            internals.push_back(line);
+        }
+    }
+    EXPECT_EQ(full_leaves, 6);
+    EXPECT_EQ(other_leaves, 1);
+    std::vector<std::string> expected = {
+        "- internal (size 1)",
+        "  - internal (size 3)",
+        "  - internal (size 2)",
+    };
+    EXPECT_EQ(internals, expected);
+}
+
+TEST_F(DatabaseTest, deletes_rows_by_id_and_by_range) {
+    std::string input = "";
+    for (int i=1; i <= 5; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += "delete 3\n";
+    input += "delete 3\n";
+    input += "delete where id between 4 and 10\n";
+    input += "delete where id between 7 and 9\n";
+    input += "delete x\n";
+    input += "select\n";
+    input += ".exit";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+
+    std::vector<std::string> expected = {
+        "db > Executed.",
+        "db > Error: Key not found.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "Executed.",
+        "db > "
+    };
+    ASSERT_EQ(lines.size(), expected.size() + 5);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(lines[i + 5], expected[i]);
+    }
+}
+
+TEST_F(DatabaseTest, stores_rows_by_their_actual_length) {
+    std::string input = "";
+    for (int i=1; i <= 100; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += ".btree\n";
+    input += ".exit";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+
+    // 短行按实际长度存放，100 行还放得下一个叶子
+    ASSERT_EQ(lines.size(), 100u + 2u + 100u + 1u);
+    EXPECT_EQ(lines[100], "db > Tree:");
+    EXPECT_EQ(lines[101], "- leaf (size 100)");
+
+    // 删除留下的空洞在插入更长的行时被压缩掉
+    input = "delete where id between 1 and 60\n";
+    for (int i=1; i <= 10; ++i) {
+        input += wideInsert(i);
+    }
+    input += "select\n.exit";
+    output = runMyDB(input);
+    lines = splitLines(output);
+
+    ASSERT_EQ(lines.size(), 11u + 50u + 2u);
+    EXPECT_EQ(lines[11], "db > " + wideRow(1));
+    for (int i=2; i <= 10; ++i) {
+        EXPECT_EQ(lines[10 + i], wideRow(i));
+    }
+    EXPECT_EQ(lines[21], "(61, user61, person61@example.com)");
+    EXPECT_EQ(lines[60], "(100, user100, person100@example.com)");
+    EXPECT_EQ(lines[61], "Executed.");
+}
+
+TEST_F(DatabaseTest, selects_an_id_range_across_leaves) {
+    std::string input = "";
+    for (int i=1; i <= 60; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += "select where id >= 12 and id < 16\n";
+    input += "select where id > 57 limit 2\n";
+    input += "select where id >= 61\n";
+    input += "select where id < 0\n";
+    input += "select where name = x\n";
+    input += ".exit";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+
+    std::vector<std::string> expected = {
+        "db > (12, user12, person12@example.com)",
+        "(13, user13, person13@example.com)",
+        "(14, user14, person14@example.com)",
+        "(15, user15, person15@example.com)",
+        "Executed.",
+        "db > (58, user58, person58@example.com)",
+        "(59, user59, person59@example.com)",
+        "Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > "
+    };
+    ASSERT_EQ(lines.size(), expected.size() + 60);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(lines[i + 60], expected[i]);
+    }
+}
+
+TEST_F(DatabaseTest, merges_underfull_nodes_and_reuses_freed_pages) {
+    std::string input = "";
+    // 37 与 101 互素，i * 37 % 101 遍历 1..100 且顺序打乱
+    for (int i=1; i <= 100; ++i) {
+        int key = i * 37 % 101;
+        input += wideInsert(key);
+    }
+    for (int i=1; i <= 100; ++i) {
+        int key = i * 37 % 101;
+        if (key % 4 != 0) {
+            input += "delete " + std::to_string(key) + "\n";
+        }
+    }
+    input += "select\n";
+    input += ".exit";
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+
+    ASSERT_EQ(lines.size(), 100u + 75u + 27u);
+    EXPECT_EQ(lines[175], "db > " + wideRow(4));
+    for (int i=2; i <= 25; ++i) {
+        int key = i * 4;
+        EXPECT_EQ(lines[174 + i], wideRow(key));
+    }
+
+    // 删空后整棵树收缩成根叶子，其余页都进了空闲链表
+    output = runMyDB("delete where id between 0 and 100\n.btree\n.stats\n.exit", "--internal-node-max-cells 3");
+    lines = splitLines(output);
+    EXPECT_EQ(lines[1], "db > Tree:");
+    EXPECT_EQ(lines[2], "- leaf (size 0)");
+    std::string pages = findLine(lines, "pages: ");
+    std::string free_pages = findLine(lines, "free_pages: ");
+    ASSERT_FALSE(pages.empty());
+    int num_pages = std::stoi(pages.substr(7));
+    EXPECT_GT(num_pages, 10);
+    EXPECT_EQ(free_pages, "free_pages: " + std::to_string(num_pages - 2));
+
+    // 重新插入时先用空闲页，文件不再变大
+    input = "";
+    for (int i=1; i <= 100; ++i) {
+        int key = i * 37 % 101;
+        input += wideInsert(key);
+    }
+    input += ".stats\n.exit";
+    output = runMyDB(input, "--internal-node-max-cells 3");
+    lines = splitLines(output);
+    EXPECT_EQ(findLine(lines, "pages: "), pages);
+}
+
+TEST_F(DatabaseTest, merges_the_tail_of_appended_rows_when_it_is_deleted) {
+    std::string input = "";
+    for (int i=1; i <= 53; ++i) {
+        input += wideInsert(i);
+    }
+    // 顺序追加后最右边的叶子是只有一个孩子的父节点下唯一的孩子
+    input += "delete where id between 40 and 53\n";
+    input += ".btree\n";
+    input += ".exit";
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+
+    std::vector<std::string> shape;
+    for (const std::string& line : lines) {
+        if (line.find("- internal") != std::string::npos || line.find("- leaf") != std::string::npos ||
+            line.find("- key") != std::string::npos) {
+            shape.push_back(line);
+        }
+    }
+    std::vector<std::string> expected = {
+        "- internal (size 2)",
+        "  - leaf (size 13)",
+        "  - key 13",
+        "  - leaf (size 13)",
+        "  - key 26",
+        "  - leaf (size 13)",
+    };
+    EXPECT_EQ(shape, expected);
+}
+
+TEST_F(DatabaseTest, bulk_loads_sorted_rows_into_a_multi_level_tree) {
+    {
+        std::ofstream rows("test_rows.txt");
+        for (int i=1; i <= 500; ++i) {
+            rows << i << " user" << i << " person" << i << "@example.com\n";
+        }
+    }
+    std::string output = runMyDB(".load test_rows.txt 50\n.exit\n", "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[0], "db > Loaded 500 rows.");
+
+    // 普通插入和查询在装载出来的树上照常工作
+    std::string input = "insert 250 user250 person250@example.com\n";
+    input += "insert 501 user501 person501@example.com\n";
+    input += "select\n.exit\n";
+    output = runMyDB(input, "--internal-node-max-cells 3");
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 505u);
+    EXPECT_EQ(lines[0], "db > Error: Duplicate key.");
+    EXPECT_EQ(lines[1], "db > Executed.");
+    EXPECT_EQ(lines[2], "db > (1, user1, person1@example.com)");
+    for (int i=2; i <= 501; ++i) {
+        EXPECT_EQ(lines[i + 1], "(" + std::to_string(i) + ", user" + std::to_string(i) + ", person" + std::to_string(i) + "@example.com)");
+    }
+    std::remove("test_rows.txt");
+}
+
+TEST_F(DatabaseTest, bulk_load_rejects_unsorted_input_and_non_empty_tables) {
+    {
+        std::ofstream rows("test_rows.txt");
+        rows << "1 user1 person1@example.com\n";
+        rows << "3 user3 person3@example.com\n";
+        rows << "2 user2 person2@example.com\n";
+    }
+    std::string output = runMyDB(".load test_rows.txt\nselect\n.exit\n");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0], "db > Error: Keys must be sorted, line 3 is out of order.");
+    EXPECT_EQ(lines[1], "db > Executed.");
+
+    output = runMyDB("insert 1 a b\n.load test_rows.txt\n.exit\n");
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[1], "db > Bulk load needs an empty table.");
+    std::remove("test_rows.txt");
+}
+
+TEST_F(DatabaseTest, bulk_load_rejects_malformed_ids_and_fill_percents) {
+    for (std::string bad : {"x", "-1", "4294967296", "2x"}) {
+        {
+            std::ofstream rows("test_rows.txt");
+            rows << "1 user1 person1@example.com\n";
+            rows << bad << " user2 person2@example.com\n";
+        }
+        std::string output = runMyDB(".load test_rows.txt\nselect\n.exit\n");
+        std::vector<std::string> lines = splitLines(output);
+        ASSERT_EQ(lines.size(), 3u) << bad;
+        EXPECT_EQ(lines[0], "db > Invalid id on line 2 of 'test_rows.txt'.") << bad;
+        EXPECT_EQ(lines[1], "db > Executed.") << bad;
+    }
+
+    for (std::string fill : {"-5", "0", "101", "abc", "50 extra"}) {
+        std::string output = runMyDB(".load test_rows.txt " + fill + "\n.exit\n");
+        std::vector<std::string> lines = splitLines(output);
+        ASSERT_EQ(lines.size(), 2u) << fill;
+        EXPECT_EQ(lines[0], "db > Usage: .load <file> [fill_percent]") << fill;
+    }
+
+    // Windows 换行的文件，\r 不会留在 email 里
+    {
+        std::ofstream rows("test_rows.txt");
+        rows << "1 user1 person1@example.com\r\n";
+        rows << "2 user2 person2@example.com\r\n";
+    }
+    std::string output = runMyDB(".load test_rows.txt 100\nselect\n.exit\n");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 5u);
+    EXPECT_EQ(lines[0], "db > Loaded 2 rows.");
+    EXPECT_EQ(lines[1], "db > (1, user1, person1@example.com)");
+    EXPECT_EQ(lines[2], "(2, user2, person2@example.com)");
+    std::remove("test_rows.txt");
+}
+
+TEST_F(DatabaseTest, serves_more_pages_than_the_buffer_pool_holds) {
+    std::string input = "";
+
+    for (int i=1; i <= 1400; ++i) {
+        input += wideInsert(i);
+    }
+    input += ".exit";
+    std::string output = runMyDB(input, "--cache-pages 32");
+    std::vector<std::string> lines = splitLines(output);
+
+    // 1400 行需要一百多个页，远超 32 个帧
+    EXPECT_EQ(lines.size(), 1401u);
+    EXPECT_EQ(lines[1399], "db > Executed.");
+
+    input = "select\n.stats\n.exit";
+    output = runMyDB(input, "--cache-pages 32");
+    lines = splitLines(output);
+
+    ASSERT_EQ(lines.size(), 1431u);
+    EXPECT_EQ(lines[0], "db > " + wideRow(1));
+    EXPECT_EQ(lines[1399], wideRow(1400));
+    EXPECT_EQ(lines[1400], "Executed.");
+    EXPECT_EQ(lines[1401], "db > frames: 32/32");
+    EXPECT_EQ(lines[1402], "pinned: 0");
+}
+
+TEST_F(DatabaseTest, reads_ahead_during_sequential_scans) {
+    std::string input = "";
+
+    for (int i=1; i <= 1400; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += ".exit";
+    runMyDB(input);
+
+    input = "select\n.stats\n.exit";
+    std::string output = runMyDB(input, "--cache-pages 32");
+    std::vector<std::string> lines = splitLines(output);
+
+    EXPECT_EQ(findLine(lines, "scans: "), "scans: 1");
+    EXPECT_EQ(findLine(lines, "scan_rows: "), "scan_rows: 1400");
+    EXPECT_NE(findLine(lines, "readahead_calls: "), "readahead_calls: 0");
+    EXPECT_NE(findLine(lines, "readahead_pages: "), "readahead_pages: 0");
+
+    // --readahead 0 关闭预读
+    output = runMyDB(input, "--cache-pages 32 --readahead 0");
+    lines = splitLines(output);
+
+    EXPECT_EQ(findLine(lines, "scan_rows: "), "scan_rows: 1400");
+    EXPECT_EQ(findLine(lines, "readahead_calls: "), "readahead_calls: 0");
+}
+
+TEST_F(DatabaseTest, falls_back_to_synchronous_io_without_io_uring) {
+    std::string input = "";
+
+    for (int i=1; i <= 1400; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += ".exit";
+    runMyDB(input, "--no-uring");
+
+    // 两种 I/O 路径读出的结果必须一致
+    input = "select\n.stats\n.exit";
+    std::string output = runMyDB(input, "--cache-pages 32 --no-uring");
+    std::vector<std::string> lines = splitLines(output);
+
+    ASSERT_GT(lines.size(), 1400u);
+    EXPECT_EQ(lines[1399], "(1400, user1400, person1400@example.com)");
+    EXPECT_EQ(findLine(lines, "io_mode: "), "io_mode: sync");
+    EXPECT_EQ(findLine(lines, "pinned: "), "pinned: 0");
+
+    output = runMyDB(input, "--cache-pages 32");
+    lines = splitLines(output);
+
+    ASSERT_GT(lines.size(), 1400u);
+    EXPECT_EQ(lines[1399], "(1400, user1400, person1400@example.com)");
+    EXPECT_EQ(findLine(lines, "scan_rows: "), "scan_rows: 1400");
+}
+
+TEST_F(DatabaseTest, flushes_only_dirty_pages_in_coalesced_writes) {
+    std::string input = "";
+
+    for (int i=1; i <= 100; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += ".flush\n.stats\n.exit";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+
+    // 新建的页号连续，一次 pwritev 写完
+    EXPECT_NE(findLine(lines, "pages_written: "), "pages_written: 0");
+    EXPECT_EQ(findLine(lines, "write_calls: "), "write_calls: 1");
+
+    // 只读会话不应写回任何页
+    input = "select\n.flush\n.stats\n.exit";
+    output = runMyDB(input);
+    lines = splitLines(output);
+
+    EXPECT_EQ(findLine(lines, "pages_written: "), "pages_written: 0");
+    EXPECT_EQ(findLine(lines, "write_calls: "), "write_calls: 0");
+}
+
+TEST_F(DatabaseTest, recovers_committed_inserts_from_wal_after_crash) {
+    std::string input = "";
+    for (int i=1; i <= 50; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    runMyDBAndKill(input);
+
+    input = "select\n.exit";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+
+    ASSERT_EQ(lines.size(), 52u);
+    EXPECT_EQ(lines[0], "db > (1, user1, person1@example.com)");
+    EXPECT_EQ(lines[49], "(50, user50, person50@example.com)");
+    EXPECT_EQ(lines[50], "Executed.");
+}
+
+TEST_F(DatabaseTest, mmap_pager_keeps_data_after_closing_connection) {
+    std::string input = "";
+    for (int i=1; i <= 200; ++i) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i) + " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += ".exit";
+    std::string output = runMyDB(input, "--mmap");
+    std::vector<std::string> lines = splitLines(output);
+    EXPECT_EQ(lines.size(), 201u);
+
+    // mmap 写出的文件可以被普通 pager 读取，反之亦然
+    input = "select\n.exit";
+    output = runMyDB(input);
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 202u);
+    EXPECT_EQ(lines[0], "db > (1, user1, person1@example.com)");
+    EXPECT_EQ(lines[199], "(200, user200, person200@example.com)");
+
+    output = runMyDB(input, "--mmap");
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 202u);
+    EXPECT_EQ(lines[199], "(200, user200, person200@example.com)");
+}
+
+TEST_F(DatabaseTest, rejects_file_without_header_page) {
+    {
+        std::ofstream db("test.db", std::ios::binary);
+        std::string garbage(4096, 'x');
+        db << garbage;
+    }
+    std::string output = runMyDB("select\n.exit\n", "--no-wal");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_EQ(lines[0], "Db file has no valid header page. Unsupported file format.");
+}
+
+TEST_F(DatabaseTest, looks_up_rows_through_secondary_indexes) {
+    // 两个用户名各有 100 行，超过一个索引列表能放的 id 数
+    std::string input;
+    for (int i = 1; i <= 200; i++) {
+        input += "insert " + std::to_string(i) + " user" + std::to_string(i % 2) +
+                 " person" + std::to_string(i) + "@example.com\n";
+    }
+    input += "create index on users(email)\n";
+    input += "create index on users(username)\n";
+    input += "create index on users(email)\n";
+    input += "select where email = person42@example.com\n";
+    input += ".exit\n";
+    std::string output = runMyDB(input, "--internal-node-max-cells 3");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 206u);
+    EXPECT_EQ(lines[202], "db > Error: Index already exists.");
+    EXPECT_EQ(lines[203], "db > (42, user0, person42@example.com)");
+
+    // 索引在重新打开后还在，并且随插入和删除更新
+    input = "delete 3\n";
+    input += "insert 201 user1 person201@example.com\n";
+    input += "select where username = user1 and id < 10\n";
+    input += "select where email = person3@example.com\n";
+    input += "select where username = user1 and id > 195\n";
+    input += "select where username = nobody\n";
+    input += ".stats\n.exit\n";
+    output = runMyDB(input, "--internal-node-max-cells 3");
+    lines = splitLines(output);
+    EXPECT_EQ(lines[2], "db > (1, user1, person1@example.com)");
+    EXPECT_EQ(lines[3], "(5, user1, person5@example.com)");
+    EXPECT_EQ(lines[6], "Executed.");
+    EXPECT_EQ(lines[7], "db > Executed.");
+    EXPECT_EQ(lines[8], "db > (197, user1, person197@example.com)");
+    EXPECT_EQ(lines[10], "(201, user1, person201@example.com)");
+    EXPECT_EQ(lines[12], "db > Executed.");
+    EXPECT_EQ(findLine(lines, "scans: "), "scans: 0");
+    EXPECT_EQ(findLine(lines, "index_lookups: "), "index_lookups: 4");
+
+    // 没有索引的列条件退回到扫描过滤，结果一样
+    std::remove("test.db");
+    std::remove("test.db-wal");
+    output = runMyDB("insert 1 a x@y\ninsert 2 b x@y\nselect where email = x@y limit 1\n.exit\n");
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 5u);
+    EXPECT_EQ(lines[2], "db > (1, a, x@y)");
+}
+
+TEST_F(DatabaseTest, stores_rows_in_a_hash_table_when_created_with_hash) {
+    // 宽行让桶很快分裂，目录也要翻倍几次
+    std::string input;
+    for (int i = 200; i >= 1; i--) {
+        input += wideInsert(i);
+    }
+    input += wideInsert(7);
+    input += ".exit\n";
+    std::string output = runMyDB(input, "--hash");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 202u);
+    EXPECT_EQ(lines[200], "db > Error: Duplicate key.");
+
+    // 文件记住了组织方式，重新打开时不用再给 --hash
+    input = "select where id = 42\n";
+    input += "delete 43\n";
+    input += "delete where id between 100 and 197\n";
+    input += "select where id >= 40 and id < 45\n";
+    input += "select where id > 190\n";
+    input += ".btree\n";
+    input += ".exit\n";
+    output = runMyDB(input);
+    lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 16u);
+    EXPECT_EQ(lines[0], "db > " + wideRow(42));
+    EXPECT_EQ(lines[4], "db > " + wideRow(40));
+    EXPECT_EQ(lines[7], wideRow(44));
+    EXPECT_EQ(lines[9], "db > " + wideRow(198));
+    EXPECT_EQ(lines[13], "db > Hash table:");
+    EXPECT_EQ(lines[14].substr(lines[14].rfind(',')), ", 101 rows");
+}
+
+TEST_F(DatabaseTest, parses_operators_without_spaces_and_raw_values) {
+    // 插入的值原样取到下一个空白为止，运算符两边可以不留空格
+    std::string input = "insert 1 a(b x=y@z\n";
+    input += "insert\t2   c d\n";
+    input += "insert 3 e f g\n";
+    input += "select where id>=1 and id<=2 limit 5;\n";
+    input += "select where email = x=y@z\n";
+    input += "select where id =\n";
+    input += ".exit\n";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 10u);
+    EXPECT_EQ(lines[0], "db > Executed.");
+    EXPECT_EQ(lines[1], "db > Executed.");
+    EXPECT_EQ(lines[2], "db > Syntax error. Could not parse statement.");
+    EXPECT_EQ(lines[3], "db > (1, a(b, x=y@z)");
+    EXPECT_EQ(lines[4], "(2, c, d)");
+    EXPECT_EQ(lines[5], "Executed.");
+    EXPECT_EQ(lines[6], "db > (1, a(b, x=y@z)");
+    EXPECT_EQ(lines[7], "Executed.");
+    EXPECT_EQ(lines[8], "db > Syntax error. Could not parse statement.");
+}
+
+TEST_F(DatabaseTest, executes_prepared_statements_with_bound_parameters) {
+    std::string input = "prepare ins as insert ? ? ?\n";
+    input += "execute ins 1 alice alice@example.com\n";
+    input += "execute ins 2 bob bob@example.com\n";
+    input += "execute ins x carol carol@example.com\n";
+    input += "execute ins 3 carol\n";
+    input += "prepare sel as select where id >= ? and id <= 2 limit ?\n";
+    input += "execute sel 2 10\n";
+    input += "prepare del as delete ?\n";
+    input += "execute del 1\n";
+    input += "execute sel 0 10\n";
+    input += "execute missing 1\n";
+    input += ".exit\n";
+    std::string output = runMyDB(input);
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 14u);
+    EXPECT_EQ(lines[0], "db > Prepared.");
+    EXPECT_EQ(lines[1], "db > Executed.");
+    EXPECT_EQ(lines[2], "db > Executed.");
+    EXPECT_EQ(lines[3], "db > Error: Parameter 1 must be a number.");
+    EXPECT_EQ(lines[4], "db > Error: Expected 3 parameters.");
+    EXPECT_EQ(lines[5], "db > Prepared.");
+    EXPECT_EQ(lines[6], "db > (2, bob, bob@example.com)");
+    EXPECT_EQ(lines[7], "Executed.");
+    EXPECT_EQ(lines[8], "db > Prepared.");
+    EXPECT_EQ(lines[9], "db > Executed.");
+    EXPECT_EQ(lines[10], "db > (2, bob, bob@example.com)");
+    EXPECT_EQ(lines[11], "Executed.");
+    EXPECT_EQ(lines[12], "db > Error: No prepared statement named 'missing'.");
+}
+
+TEST_F(DatabaseTest, keeps_literal_ids_in_prepared_inserts) {
+    std::string input = "prepare ins as insert 5 ? ?\n";
+    input += "execute ins alice alice@example.com\n";
+    input += "prepare named as insert ? bob ?\n";
+    input += "execute named 7 bob@example.com\n";
+    input += "select\n";
+    std::string output = runMyDB(input, "--batch");
+    EXPECT_EQ(output, "(5, alice, alice@example.com)\n(7, bob, bob@example.com)\n");
+}
+
+TEST_F(DatabaseTest, writes_select_results_as_tsv_or_binary) {
+    std::string input = "insert 1 alice alice@example.com\ninsert 2 bob b@x\nselect\n.exit\n";
+    std::string output = runMyDB(input, "--output tsv");
+    std::vector<std::string> lines = splitLines(output);
+    ASSERT_EQ(lines.size(), 6u);
+    EXPECT_EQ(lines[2], "db > 1\talice\talice@example.com");
+    EXPECT_EQ(lines[3], "2\tbob\tb@x");
+    EXPECT_EQ(lines[4], "Executed.");
+
+    // 每行是 4 字节的 id，再是两个长度字节和两个字符串
+    output = runMyDB("select\n.exit\n", "--output binary");
+    std::string row1 = std::string("\x01\0\0\0\x05\x11", 6) + "alicealice@example.com";
+    std::string row2 = std::string("\x02\0\0\0\x03\x03", 6) + "bobb@x";
+    EXPECT_EQ(output, "db > " + row1 + row2 + "Executed.\ndb > ");
+}
+
+TEST_F(DatabaseTest, batch_mode_prints_only_results_and_errors) {
+    // 没有提示符和 Executed.，输入结束时不需要 .exit
+    std::string input = "insert 1 alice alice@example.com\n\n";
+    input += "insert 1 alice alice@example.com\n";
+    input += "prepare ins as insert ? ? ?\n";
+    input += "execute ins 2 bob b@x\n";
+    input += "select\n";
+    std::string output = runMyDB(input, "--batch");
+    EXPECT_EQ(output, "Error: Duplicate key.\n(1, alice, alice@example.com)\n(2, bob, b@x)\n");
+
+    output = runMyDB("select where id = 2\n", "--batch");
+    EXPECT_EQ(output, "(2, bob, b@x)\n");
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-}
\ No newline at end of file
+}